@@ -14,11 +14,16 @@
 #include <cstdlib>
 #include <cerrno>
 #include <cassert>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <climits>
+#include <pthread.h>
 
 // Generic C++
 #include <iostream>
 #include <string>
 #include <sstream>
+#include <algorithm>
 
 // uArchSim modules
 #include <elf_parser.h>
@@ -33,83 +38,615 @@ ElfSection::ElfSection()
 }
 
 ElfSection::ElfSection( const ElfSection& that)
-    : size( that.size), start_addr( that.start_addr)
+    : mapping( that.mapping),
+      name( that.name),
+      size( that.size),
+      file_size( that.file_size),
+      start_addr( that.start_addr),
+      content( that.content),
+      flags( that.flags)
 {
-    this->name = new char[ strlen( that.name) + 1];
-    strcpy( this->name, that.name);
-    
-    this->content = new uint8[size];
-    memcpy(this->content, that.content, this->size);
+    acquire( this->mapping);
 }
 
 ElfSection& ElfSection::operator=(const ElfSection& that)
 {
-    this->name = new char[ strlen( that.name) + 1];
-    strcpy( this->name, that.name);
-    
+    // the new mapping is taken first as it can be the same one
+    acquire( that.mapping);
+    release( this->mapping);
+
+    this->mapping = that.mapping;
+    this->name = that.name;
     this->size = that.size;
+    this->file_size = that.file_size;
     this->start_addr = that.start_addr;
+    this->content = that.content;
+    this->flags = that.flags;
 
-    this->content = new uint8[ this->size + sizeof( uint64)];
-    memcpy( this->content, that.content, this->size);
-        
     return *this;
 }
 
-ElfSection::ElfSection( const char* name, uint64 start_addr,
-                        uint64 size, const uint8* content)
+#if __cplusplus >= 201103L
+ElfSection::ElfSection( ElfSection&& that)
+    : mapping( that.mapping),
+      name( that.name),
+      size( that.size),
+      file_size( that.file_size),
+      start_addr( that.start_addr),
+      content( that.content),
+      flags( that.flags)
 {
-    this->name = new char[ strlen( name) + 1];
-    strcpy( this->name, name);
+    // the section moved out refers to no mapping
+    that.mapping = NULL;
+}
+
+ElfSection& ElfSection::operator=( ElfSection&& that)
+{
+    if ( this == &that)
+        return *this;
 
-    this->size = size;
-    this->start_addr = start_addr;
+    release( this->mapping);
 
-    this->content = new uint8[ this->size + sizeof( uint64)];
-    memcpy( this->content, content, size);
+    this->mapping = that.mapping;
+    this->name = that.name;
+    this->size = that.size;
+    this->file_size = that.file_size;
+    this->start_addr = that.start_addr;
+    this->content = that.content;
+    this->flags = that.flags;
+
+    that.mapping = NULL;
+    return *this;
 }
+#endif
 
-void ElfSection::getAllElfSections( const char* elf_file_name,
-                                    vector<ElfSection>& sections_array /*is used as output*/)
+ElfSection::ElfSection( Mapping* mapping, const char* name, uint64 start_addr,
+                        uint64 size, uint64 file_size, const uint8* content, uint64 flags)
+    : mapping( mapping),
+      name( name),
+      size( size),
+      file_size( file_size),
+      start_addr( start_addr),
+      content( content),
+      flags( flags)
+{
+    acquire( this->mapping);
+}
+
+void ElfSection::acquire( Mapping* mapping)
+{
+    if ( mapping == NULL)
+        return;
+
+    // the sections of a file can be passed to different threads
+    __atomic_fetch_add( &mapping->ref_count, 1, __ATOMIC_RELAXED);
+}
+
+void ElfSection::release( Mapping* mapping)
+{
+    if ( mapping == NULL)
+        return;
+
+    if ( __atomic_sub_fetch( &mapping->ref_count, 1, __ATOMIC_ACQ_REL) != 0)
+        return;
+
+    munmap( mapping->base, mapping->file_size);
+    delete mapping;
+}
+
+// prints the error message and exits
+static void fail( const string& error)
+{
+    cerr << "ERROR: " << error << endl;
+    exit( EXIT_FAILURE);
+}
+
+// the version is global for the ELF library, so it is set once
+static pthread_once_t elf_version_once = PTHREAD_ONCE_INIT;
+static bool elf_version_is_set = false;
+
+static void setElfVersion()
+{
+    elf_version_is_set = elf_version( EV_CURRENT) != EV_NONE;
+}
+
+// Opens the ELF binary file, the descriptor is returned via the 2nd parameter.
+// Returns NULL with the error message if the file could not be opened.
+static Elf* openElf( const char* elf_file_name, int& file_descr /*is used as output*/,
+                     string& error /*is used as output*/)
 {
+    ostringstream oss;
+
     // open the binary file, we have to use C-style open,
     // because it is required by elf_begin function
-    int file_descr = open( elf_file_name, O_RDONLY); 
+    file_descr = open( elf_file_name, O_RDONLY); 
     if ( file_descr < 0)
     {
-        cerr << "ERROR: Could not open file " << elf_file_name << ": "
-             << strerror( errno) << endl;
-        exit( EXIT_FAILURE);
+        oss << "Could not open file " << elf_file_name << ": " << strerror( errno);
+        error = oss.str();
+        return NULL;
     }
 
     // set ELF library operating version
-    if ( elf_version( EV_CURRENT) == EV_NONE)
+    pthread_once( &elf_version_once, setElfVersion);
+    if ( !elf_version_is_set)
     {
-        cerr << "ERROR: Could not set ELF library operating version:"
-             <<  elf_errmsg( elf_errno()) << endl;
-        exit( EXIT_FAILURE);
+        oss << "Could not set ELF library operating version:" << elf_errmsg( elf_errno());
+        error = oss.str();
+        close( file_descr);
+        return NULL;
     }
    
-    // open the file in ELF format 
+    // open the file in ELF format, the files are opened by several threads
+    // at once, the library keeps no shared state for them but the version
     Elf* elf = elf_begin( file_descr, ELF_C_READ, NULL);
-    if ( !elf)
+    if ( !elf || elf_kind( elf) != ELF_K_ELF)
     {
-        cerr << "ERROR: Could not open file " << elf_file_name
-             << " as ELF file: "
-             <<  elf_errmsg( elf_errno()) << endl;
-        exit( EXIT_FAILURE);
+        oss << "Could not open file " << elf_file_name << " as ELF file: "
+            << ( elf ? "not an ELF file" : elf_errmsg( elf_errno()));
+        error = oss.str();
+        if ( elf)
+            elf_end( elf);
+        close( file_descr);
+        return NULL;
     }
-    
+
+    return elf;
+}
+
+// the same, but exits with the error message
+static Elf* openElf( const char* elf_file_name, int& file_descr /*is used as output*/)
+{
+    string error;
+    Elf* elf = openElf( elf_file_name, file_descr, error);
+    if ( elf == NULL)
+        fail( error);
+
+    return elf;
+}
+
+//
+// The cache of the sections of an ELF file consists of uint64 words
+// in the host byte order:
+//   header                                  - CACHE_HEADER_SIZE words
+//   records of the sections                 - CACHE_RECORD_SIZE words each
+//   names of the sections terminated by zeros
+//   contents of the sections                - aligned by CACHE_ALIGNMENT bytes
+// The offsets of the names and the contents are from the file start.
+// The sections without data in the file have no content in the cache.
+//
+static const uint64 CACHE_MAGIC = 0x3230484343464c45ull; // "ELFCCH02"
+static const uint64 CACHE_ALIGNMENT = sizeof( uint64);
+
+enum CacheHeader
+{
+    CACHE_MAGIC_WORD,
+    CACHE_ELF_SIZE,      // the ELF file the cache is made of
+    CACHE_ELF_MTIME_SEC,
+    CACHE_ELF_MTIME_NSEC,
+    CACHE_ELF_HASH,
+    CACHE_ENTRY,
+    CACHE_BIG_ENDIAN,
+    CACHE_SECTIONS_NUM,
+    CACHE_HEADER_SIZE
+};
+
+enum CacheRecord
+{
+    CACHE_NAME,
+    CACHE_ADDR,
+    CACHE_SIZE,
+    CACHE_FILE_SIZE,
+    CACHE_FLAGS,
+    CACHE_CONTENT,
+    CACHE_RECORD_SIZE
+};
+
+// puts the name of the cache into the buffer of PATH_MAX bytes,
+// returns false if the name is too long
+static bool cacheFileName( const char* elf_file_name, char* cache_file_name /*is used as output*/)
+{
+    int length = snprintf( cache_file_name, PATH_MAX, "%s.cache", elf_file_name);
+    return length > 0 && length < PATH_MAX;
+}
+
+// FNV-1a taking 8 bytes at a time, a changed word always changes the hash
+static uint64 hashBytes( const uint8* data, uint64 size)
+{
+    const uint64 prime = 0x100000001b3ull;
+    uint64 hash = 0xcbf29ce484222325ull;
+
+    uint64 i = 0;
+    for ( ; i + sizeof( uint64) <= size; i += sizeof( uint64))
+    {
+        uint64 word;
+        memcpy( &word, data + i, sizeof( uint64));
+        hash = ( hash ^ word) * prime;
+    }
+
+    for ( ; i < size; ++i)
+        hash = ( hash ^ data[ i]) * prime;
+
+    return hash ^ size;
+}
+
+// hashes the content of the file, returns false if it could not be read
+static bool hashFile( const char* file_name, uint64 size, uint64& hash /*is used as output*/)
+{
+    int file_descr = open( file_name, O_RDONLY);
+    if ( file_descr < 0)
+        return false;
+
+    void* data = size == 0 ? NULL : mmap( NULL, size, PROT_READ, MAP_PRIVATE, file_descr, 0);
+    close( file_descr);
+    if ( data == MAP_FAILED)
+        return false;
+
+    hash = hashBytes( ( const uint8*)data, size);
+    if ( data != NULL)
+        munmap( data, size);
+
+    return true;
+}
+
+ElfSection::Mapping* ElfSection::openCache( const char* elf_file_name)
+{
+    struct stat elf_stat;
+    if ( stat( elf_file_name, &elf_stat) != 0)
+        return NULL;
+
+    // the name is not allocated, so the loading allocates nothing per file
+    char cache_file_name[ PATH_MAX];
+    if ( !cacheFileName( elf_file_name, cache_file_name))
+        return NULL;
+
+    int cache_descr = open( cache_file_name, O_RDONLY);
+    if ( cache_descr < 0)
+        return NULL;
+
+    // the header is checked before the cache is mapped
+    uint64 header[ CACHE_HEADER_SIZE];
+    if ( pread( cache_descr, header, sizeof( header), 0) != ( ssize_t)sizeof( header) ||
+         header[ CACHE_MAGIC_WORD] != CACHE_MAGIC ||
+         header[ CACHE_ELF_SIZE] != ( uint64)elf_stat.st_size)
+    {
+        close( cache_descr);
+        return NULL;
+    }
+
+    // the cache which could not be mapped is ignored like a broken one
+    string error;
+    Mapping* cache = mapFile( cache_file_name, cache_descr, error);
+    close( cache_descr);
+    if ( cache == NULL)
+        return NULL;
+
+    // a file touched without changes keeps its cache
+    bool is_valid = ( header[ CACHE_ELF_MTIME_SEC] == ( uint64)elf_stat.st_mtim.tv_sec &&
+                      header[ CACHE_ELF_MTIME_NSEC] == ( uint64)elf_stat.st_mtim.tv_nsec);
+    bool is_hashed = false;
+    uint64 hash;
+    if ( !is_valid && hashFile( elf_file_name, elf_stat.st_size, hash))
+    {
+        is_valid = hash == header[ CACHE_ELF_HASH];
+        is_hashed = is_valid;
+    }
+
+    // all the names and the contents must be inside the cache
+    uint64 sections_num = header[ CACHE_SECTIONS_NUM];
+    uint64 records_end = ( CACHE_HEADER_SIZE + sections_num * CACHE_RECORD_SIZE) * sizeof( uint64);
+    if ( sections_num > cache->file_size / sizeof( uint64) || records_end > cache->file_size)
+        is_valid = false;
+
+    const uint64* record = ( const uint64*)cache->base + CACHE_HEADER_SIZE;
+    for ( uint64 i = 0; is_valid && i < sections_num; ++i, record += CACHE_RECORD_SIZE)
+    {
+        uint64 name = record[ CACHE_NAME];
+        uint64 content = record[ CACHE_CONTENT];
+        uint64 file_size = record[ CACHE_FILE_SIZE];
+
+        is_valid = name >= records_end && name < cache->file_size &&
+                   memchr( cache->base + name, 0, cache->file_size - name) != NULL &&
+                   ( file_size == 0 || ( file_size == record[ CACHE_SIZE] &&
+                                         content <= cache->file_size &&
+                                         file_size <= cache->file_size - content));
+    }
+
+    if ( !is_valid)
+    {
+        release( cache);
+        return NULL;
+    }
+    cache->is_cache = true;
+    cache->is_big_endian = header[ CACHE_BIG_ENDIAN] != 0;
+
+    // The new time is saved, so the next loadings need not hash the file.
+    // A loader reading the header meanwhile could see the half-updated
+    // time, then it just hashes the file too.
+    if ( is_hashed)
+    {
+        uint64 mtime[ 2] = { ( uint64)elf_stat.st_mtim.tv_sec, ( uint64)elf_stat.st_mtim.tv_nsec };
+        int cache_descr = open( cache_file_name, O_WRONLY);
+        if ( cache_descr >= 0)
+        {
+            ssize_t written = pwrite( cache_descr, mtime, sizeof( mtime),
+                                      CACHE_ELF_MTIME_SEC * sizeof( uint64));
+            ( void)written; // a read-only cache is still valid, just slower
+            close( cache_descr);
+        }
+    }
+
+    return cache;
+}
+
+void ElfSection::saveCache( const char* elf_file_name)
+{
+    string error;
+    if ( !saveCache( elf_file_name, error))
+        fail( error);
+}
+
+bool ElfSection::saveCache( const char* elf_file_name, string& error /*is used as output*/)
+{
+    vector<ElfSection> sections_array;
+    return parseElfSections( elf_file_name, sections_array, error) &&
+           saveCache( elf_file_name, sections_array, error);
+}
+
+bool ElfSection::saveCache( const char* elf_file_name,
+                            const vector<ElfSection>& sections_array,
+                            string& error /*is used as output*/)
+{
+    ostringstream oss;
+
+    bool is_cached = true;
+    for ( size_t i = 0; i < sections_array.size(); ++i)
+        is_cached = is_cached && sections_array[ i].mapping->is_cache;
+    if ( is_cached && !sections_array.empty())
+        return true;
+
+    struct stat elf_stat;
+    uint64 hash;
+    if ( stat( elf_file_name, &elf_stat) != 0 ||
+         !hashFile( elf_file_name, elf_stat.st_size, hash))
+    {
+        oss << "Could not read file " << elf_file_name << ": " << strerror( errno);
+        error = oss.str();
+        return false;
+    }
+
+    int file_descr;
+    Elf* elf = openElf( elf_file_name, file_descr, error);
+    if ( elf == NULL)
+        return false;
+    char* ident = elf_getident( elf, NULL);
+    GElf_Ehdr ehdr;
+    bool has_ehdr = gelf_getehdr( elf, &ehdr) != NULL;
+    bool is_big_endian = ident != NULL && ident[ EI_DATA] == ELFDATA2MSB;
+    elf_end( elf);
+    close( file_descr);
+
+    vector<uint64> words( CACHE_HEADER_SIZE + sections_array.size() * CACHE_RECORD_SIZE, 0);
+    words[ CACHE_MAGIC_WORD] = CACHE_MAGIC;
+    words[ CACHE_ELF_SIZE] = elf_stat.st_size;
+    words[ CACHE_ELF_MTIME_SEC] = elf_stat.st_mtim.tv_sec;
+    words[ CACHE_ELF_MTIME_NSEC] = elf_stat.st_mtim.tv_nsec;
+    words[ CACHE_ELF_HASH] = hash;
+    words[ CACHE_ENTRY] = has_ehdr ? ehdr.e_entry : 0;
+    words[ CACHE_BIG_ENDIAN] = is_big_endian ? 1 : 0;
+    words[ CACHE_SECTIONS_NUM] = sections_array.size();
+
+    // the names follow the records, the contents follow the names
+    string names;
+    uint64 names_start = words.size() * sizeof( uint64);
+    for ( size_t i = 0; i < sections_array.size(); ++i)
+    {
+        uint64* record = &words[ CACHE_HEADER_SIZE + i * CACHE_RECORD_SIZE];
+        record[ CACHE_NAME] = names_start + names.size();
+        names.append( sections_array[ i].name, strlen( sections_array[ i].name) + 1);
+    }
+
+    uint64 offset = ( names_start + names.size() + CACHE_ALIGNMENT - 1) & ~( CACHE_ALIGNMENT - 1);
+    for ( size_t i = 0; i < sections_array.size(); ++i)
+    {
+        const ElfSection& section = sections_array[ i];
+        uint64* record = &words[ CACHE_HEADER_SIZE + i * CACHE_RECORD_SIZE];
+        record[ CACHE_ADDR] = section.start_addr;
+        record[ CACHE_SIZE] = section.size;
+        record[ CACHE_FILE_SIZE] = section.file_size;
+        record[ CACHE_FLAGS] = section.flags;
+        record[ CACHE_CONTENT] = offset;
+        offset = ( offset + section.file_size + CACHE_ALIGNMENT - 1) & ~( CACHE_ALIGNMENT - 1);
+    }
+
+    // The cache appears at once, so a concurrent loader sees either none
+    // or the whole one. The temporary file is unique for each writer.
+    char cache_file_name[ PATH_MAX];
+    if ( !cacheFileName( elf_file_name, cache_file_name))
+    {
+        error = string( "The name of file ") + elf_file_name + " is too long";
+        return false;
+    }
+
+    string tmp_file_name = string( cache_file_name) + ".XXXXXX";
+    int tmp_descr = mkstemp( &tmp_file_name[ 0]);
+    FILE* file = tmp_descr < 0 ? NULL : fdopen( tmp_descr, "wb");
+    if ( file == NULL && tmp_descr >= 0)
+        close( tmp_descr);
+    bool is_written = file != NULL &&
+                      fwrite( &words[ 0], sizeof( uint64), words.size(), file) == words.size() &&
+                      fwrite( names.data(), 1, names.size(), file) == names.size();
+
+    const uint8 padding[ CACHE_ALIGNMENT] = { 0 };
+    uint64 written = names_start + names.size();
+    for ( size_t i = 0; is_written && i <= sections_array.size(); ++i)
+    {
+        // the padding up to the next content or the end
+        uint64 next = i < sections_array.size()
+                      ? words[ CACHE_HEADER_SIZE + i * CACHE_RECORD_SIZE + CACHE_CONTENT]
+                      : offset;
+        assert( next - written < sizeof( padding));
+        is_written = fwrite( padding, 1, next - written, file) == next - written;
+        written = next;
+
+        if ( i < sections_array.size() && is_written)
+        {
+            const ElfSection& section = sections_array[ i];
+            is_written = fwrite( section.content, 1, section.file_size, file) == section.file_size;
+            written += section.file_size;
+        }
+    }
+
+    if ( file != NULL && fclose( file) != 0)
+        is_written = false;
+
+    // mkstemp makes the file private, but the cache is shared like the binary
+    if ( is_written)
+        is_written = chmod( tmp_file_name.c_str(), 0644) == 0;
+
+    if ( !is_written || rename( tmp_file_name.c_str(), cache_file_name) != 0)
+    {
+        oss << "Could not write cache file " << cache_file_name << ": " << strerror( errno);
+        error = oss.str();
+        if ( tmp_descr >= 0)
+            remove( tmp_file_name.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+bool ElfSection::isBigEndian( const char* elf_file_name)
+{
+    Mapping* cache = openCache( elf_file_name);
+    if ( cache != NULL)
+    {
+        bool is_big_endian = ( ( const uint64*)cache->base)[ CACHE_BIG_ENDIAN] != 0;
+        release( cache);
+        return is_big_endian;
+    }
+
+    int file_descr;
+    Elf* elf = openElf( elf_file_name, file_descr);
+
+    char* ident = elf_getident( elf, NULL);
+    bool is_big_endian = ident != NULL && ident[ EI_DATA] == ELFDATA2MSB;
+
+    elf_end( elf);
+    close( file_descr);
+
+    return is_big_endian;
+}
+
+ElfSection::Mapping* ElfSection::mapFile( const char* elf_file_name, int file_descr,
+                                          string& error /*is used as output*/)
+{
+    ostringstream oss;
+
+    struct stat file_stat;
+    if ( fstat( file_descr, &file_stat) != 0)
+    {
+        oss << "Could not get the size of file " << elf_file_name << ": " << strerror( errno);
+        error = oss.str();
+        return NULL;
+    }
+
+    // the sections having no data in the file (e.g. ".bss") have no content
+    size_t file_size = file_stat.st_size;
+    void* base = mmap( NULL, file_size, PROT_READ, MAP_PRIVATE, file_descr, 0);
+    if ( base == MAP_FAILED)
+    {
+        oss << "Could not map file " << elf_file_name << ": " << strerror( errno);
+        error = oss.str();
+        return NULL;
+    }
+
+    Mapping* mapping = new Mapping;
+    mapping->base = ( uint8*)base;
+    mapping->file_size = file_size;
+    mapping->ref_count = 1;
+    mapping->is_cache = false;
+    mapping->is_big_endian = false;
+    return mapping;
+}
+
+void ElfSection::getAllElfSections( const char* elf_file_name,
+                                    vector<ElfSection>& sections_array /*is used as output*/)
+{
+    string error;
+    if ( !getAllElfSections( elf_file_name, sections_array, error))
+        fail( error);
+}
+
+bool ElfSection::getAllElfSections( const char* elf_file_name,
+                                    vector<ElfSection>& sections_array /*is used as output*/,
+                                    string& error /*is used as output*/)
+{
+    Mapping* cache = openCache( elf_file_name);
+    if ( cache == NULL)
+        return parseElfSections( elf_file_name, sections_array, error);
+
+    // the cache is checked by openCache, so the records are trusted
+    const uint64* header = ( const uint64*)cache->base;
+    const uint64* record = header + CACHE_HEADER_SIZE;
+
+    sections_array.reserve( sections_array.size() + header[ CACHE_SECTIONS_NUM]);
+    for ( uint64 i = 0; i < header[ CACHE_SECTIONS_NUM]; ++i, record += CACHE_RECORD_SIZE)
+    {
+        uint64 file_size = record[ CACHE_FILE_SIZE];
+        const uint8* content = file_size != 0 ? cache->base + record[ CACHE_CONTENT] : NULL;
+
+        sections_array.push_back( ElfSection( cache, ( const char*)cache->base + record[ CACHE_NAME],
+                                              record[ CACHE_ADDR], record[ CACHE_SIZE],
+                                              file_size, content, record[ CACHE_FLAGS]));
+    }
+
+    release( cache);
+    return true;
+}
+
+bool ElfSection::parseElfSections( const char* elf_file_name,
+                                   vector<ElfSection>& sections_array,
+                                   string& error)
+{
+    int file_descr;
+    Elf* elf = openElf( elf_file_name, file_descr, error);
+    if ( elf == NULL)
+        return false;
+
     size_t shstrndx;
     elf_getshdrstrndx( elf, &shstrndx);
-    
+
+    // find the section names table
+    GElf_Shdr shstrtab;
+    memset( &shstrtab, 0, sizeof( shstrtab));
+
     Elf_Scn *section = NULL;
+    for ( size_t index = 1; ( section = elf_nextscn( elf, section)) != NULL; ++index)
+        if ( index == shstrndx)
+            gelf_getshdr( section, &shstrtab);
+
+    Mapping* mapping = mapFile( elf_file_name, file_descr, error);
+    if ( mapping == NULL)
+    {
+        elf_end( elf);
+        close( file_descr);
+        return false;
+    }
+    char* ident = elf_getident( elf, NULL);
+    mapping->is_big_endian = ident != NULL && ident[ EI_DATA] == ELFDATA2MSB;
+
+    // the sections are put into the array without reallocations
+    size_t old_size = sections_array.size();
+    size_t sections_num = 0;
+    elf_getshdrnum( elf, &sections_num);
+    sections_array.reserve( sections_array.size() + sections_num);
+
     while ( (section = elf_nextscn( elf, section)) != NULL)
     {        
         GElf_Shdr shdr;
         gelf_getshdr( section, &shdr);
 
-        char* name = elf_strptr( elf, shstrndx, shdr.sh_name);
         uint64 start_addr = ( uint64)shdr.sh_addr;
         
         if ( start_addr == 0)
@@ -117,32 +654,136 @@ void ElfSection::getAllElfSections( const char* elf_file_name,
 
         uint64 size = ( uint64)shdr.sh_size;
         uint64 offset = ( uint64)shdr.sh_offset;
-	    uint8* content = new uint8[ size];
-        
-        lseek( file_descr, offset, SEEK_SET);
-        FILE *file = fdopen( file_descr, "r");
-        if ( !file )
+        uint64 flags = ( uint64)shdr.sh_flags;
+        uint64 name_offset = ( uint64)shstrtab.sh_offset + shdr.sh_name;
+        bool has_data = shdr.sh_type != SHT_NOBITS;
+
+        // the name must be terminated by zero within the table and the file
+        uint64 file_size = mapping->file_size;
+        uint64 names_end = shstrtab.sh_offset > file_size
+                           ? 0
+                           : shstrtab.sh_offset + min( ( uint64)shstrtab.sh_size,
+                                                       file_size - shstrtab.sh_offset);
+        if ( shdr.sh_name >= shstrtab.sh_size ||
+             name_offset >= names_end ||
+             memchr( mapping->base + name_offset, 0, names_end - name_offset) == NULL ||
+             ( has_data && ( offset > mapping->file_size ||
+                             size > mapping->file_size - offset)))
+        {
+            error = string( "A section of file ") + elf_file_name +
+                    " is out of the file or has a broken name";
+
+            // the array is left as it was
+            sections_array.erase( sections_array.begin() + old_size, sections_array.end());
+            release( mapping);
+            elf_end( elf);
+            close( file_descr);
+            return false;
+        }
+
+        const char* name = ( const char*)mapping->base + name_offset;
+        const uint8* content = has_data ? mapping->base + offset : NULL;
+        sections_array.push_back( ElfSection( mapping, name, start_addr, size,
+                                              has_data ? size : 0, content, flags));
+    }
+
+    // the sections keep the mapping, the file is not needed anymore
+    release( mapping);
+    elf_end( elf);
+    close( file_descr);
+    return true;
+}
+
+void ElfSection::getAllElfSegments( const char* elf_file_name,
+                                    vector<ElfSection>& segments_array /*is used as output*/)
+{
+    int file_descr;
+    Elf* elf = openElf( elf_file_name, file_descr);
+
+    // the zeroed tails of the segments are not kept in the mapping
+    string error;
+    Mapping* mapping = mapFile( elf_file_name, file_descr, error);
+    if ( mapping == NULL)
+        fail( error);
+    char* ident = elf_getident( elf, NULL);
+    mapping->is_big_endian = ident != NULL && ident[ EI_DATA] == ELFDATA2MSB;
+
+    size_t segments_num = 0;
+    elf_getphdrnum( elf, &segments_num);
+    segments_array.reserve( segments_array.size() + segments_num);
+
+    for ( size_t i = 0; i < segments_num; ++i)
+    {
+        GElf_Phdr phdr;
+        if ( gelf_getphdr( elf, i, &phdr) == NULL || phdr.p_type != PT_LOAD)
+            continue;
+
+        uint64 offset = ( uint64)phdr.p_offset;
+        uint64 file_size = ( uint64)phdr.p_filesz;
+        if ( offset > mapping->file_size || file_size > mapping->file_size - offset ||
+             file_size > phdr.p_memsz)
         {
-            cerr << "ERROR: Could not open file " << elf_file_name << ": "
-                 << strerror(errno) << endl;
+            cerr << "ERROR: A segment of file " << elf_file_name
+                 << " is out of the file" << endl;
             exit( EXIT_FAILURE);
         }
-        
-        // fill the content by the section data
-        fread( content, sizeof( uint8), size, file);
-        ElfSection section( name, start_addr, size, content);
-	    sections_array.push_back( ElfSection( name, start_addr, size, content));
+
+        uint64 flags = SHF_ALLOC | ( ( phdr.p_flags & PF_W) != 0 ? SHF_WRITE : 0)
+                                 | ( ( phdr.p_flags & PF_X) != 0 ? SHF_EXECINSTR : 0);
+        segments_array.push_back( ElfSection( mapping, "PT_LOAD", phdr.p_vaddr, phdr.p_memsz,
+                                              file_size, mapping->base + offset, flags));
     }
-    
-    // close all used files
+
+    release( mapping);
+    elf_end( elf);
+    close( file_descr);
+}
+
+uint64 ElfSection::getEntryPoint( const char* elf_file_name)
+{
+    Mapping* cache = openCache( elf_file_name);
+    if ( cache != NULL)
+    {
+        uint64 entry = ( ( const uint64*)cache->base)[ CACHE_ENTRY];
+        release( cache);
+        return entry;
+    }
+
+    int file_descr;
+    Elf* elf = openElf( elf_file_name, file_descr);
+
+    GElf_Ehdr ehdr;
+    if ( gelf_getehdr( elf, &ehdr) == NULL)
+    {
+        cerr << "ERROR: Could not read the header of ELF file " << elf_file_name
+             << ": " << elf_errmsg( elf_errno()) << endl;
+        exit( EXIT_FAILURE);
+    }
+
     elf_end( elf);
     close( file_descr);
+
+    return ( uint64)ehdr.e_entry;
+}
+
+bool ElfSection::isWritable() const
+{
+    return ( this->flags & SHF_WRITE) != 0;
+}
+
+bool ElfSection::isExecutable() const
+{
+    return ( this->flags & SHF_EXECINSTR) != 0;
+}
+
+bool ElfSection::isBigEndian() const
+{
+    return this->mapping->is_big_endian;
 }
 
 ElfSection::~ElfSection()
 {
-    delete [] this->name;
-    delete [] this->content;
+    release( this->mapping);
 }
 
 string ElfSection::dump( string indent) const
@@ -194,9 +835,10 @@ string ElfSection::strByBytes() const
         oss.width( 2); // because we need two hex symbols to print a byte (e.g. "ff")
         oss.fill( '0'); // thus, number 8 will be printed as "08"
         
-        // print a value of 
-        oss << (uint16) *( this->content + i); // need converting to uint16
-                                               // to be not preinted as an alphabet symbol	
+        // print a value of, the bytes out of the file are zeros
+        uint8 byte = i < this->file_size ? this->content[ i] : 0;
+        oss << (uint16)byte; // need converting to uint16
+                             // to be not preinted as an alphabet symbol
     }
     
     return oss.str();
@@ -214,7 +856,14 @@ string ElfSection::strByWords() const
         oss.width( 8); // because we need 8 hex symbols to print a word (e.g. "ffffffff")
         oss.fill( '0'); // thus, number a44f will be printed as "0000a44f"
         
-        oss << *( ( uint32*)this->content + i);
+        // the bytes out of the file are zeros
+        uint32 word = 0;
+        uint64 offset = i * sizeof( uint32);
+        if ( offset < this->file_size)
+            memcpy( &word, this->content + offset,
+                    min( ( uint64)sizeof( uint32), this->file_size - offset));
+
+        oss << word;
     }
     
     return oss.str();
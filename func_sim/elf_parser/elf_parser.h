@@ -20,25 +20,102 @@ using namespace std;
 
 class ElfSection
 {
+    // The ELF file is mapped into the memory once for reading, the names
+    // and the contents of all its sections point into the mapping.
+    // The mapping is unmapped when the last section referring to it
+    // is destroyed, so the sections are copied without copying data.
+    struct Mapping
+    {
+        uint8* base;
+        size_t file_size; // bytes of the file
+        uint64 ref_count; // number of the sections referring to it
+        bool   is_cache;  // the file is the valid cache of an ELF file
+        bool   is_big_endian; // the byte order of the ELF file
+    };
+
+    Mapping* mapping;
+
     // You cannot use this constructor to create an object.
     // Use the static function getAllElfSections.
     ElfSection(); 
-    ElfSection( const char* name, uint64 start_addr,
-                uint64 size, const uint8* content);
+    ElfSection( Mapping* mapping, const char* name, uint64 start_addr,
+                uint64 size, uint64 file_size, const uint8* content, uint64 flags);
+
+    static Mapping* mapFile( const char* elf_file_name, int file_descr, string& error);
+    static void acquire( Mapping* mapping);
+    static void release( Mapping* mapping);
+
+    // returns the mapping of the valid cache of the file or NULL
+    static Mapping* openCache( const char* elf_file_name);
+    static bool parseElfSections( const char* elf_file_name,
+                                  vector<ElfSection>& sections_array,
+                                  string& error);
 
 public:
-    char* name; // name of the elf section (e.g. ".text", ".data", etc)
+    const char* name; // name of the elf section (e.g. ".text", ".data", etc)
     uint64 size; // size of the section in bytes
+    uint64 file_size; // bytes of the section kept in the file, the rest are zeros
     uint64 start_addr; // the start address of the section
-    uint8* content; // the row data of the section
+    const uint8* content; // the row data of the section, it is read-only
+                          // and has file_size bytes, NULL if there are none
+    uint64 flags; // SHF_* flags of the section header
+
+    // permissions of the section loaded into the memory
+    bool isWritable() const;
+    bool isExecutable() const;
+    // the byte order of the ELF file the section is taken from
+    bool isBigEndian() const;
 
     ElfSection( const  ElfSection& old);
     ElfSection& operator=( const ElfSection& that);
+#if __cplusplus >= 201103L
+    // the moved section takes the reference of the old one to the mapping
+    ElfSection( ElfSection&& old);
+    ElfSection& operator=( ElfSection&& that);
+#endif
     
     // Use this function to extract all sections from the ELF binary file.
     // Note that the 2nd parameter is used as output.
     static void getAllElfSections( const char* elf_file_name,
                                    vector<ElfSection>& sections_array /*used as output*/);
+    // The same, but returns false with the error message instead of
+    // exiting, the array is left as it was. Several threads can load
+    // different files at once.
+    static bool getAllElfSections( const char* elf_file_name,
+                                   vector<ElfSection>& sections_array /*used as output*/,
+                                   string& error /*used as output*/);
+
+    // Use this function to save the sections, the entry point and
+    // the byte order of the ELF file into the cache "<file>.cache".
+    // Then getAllElfSections, getEntryPoint and isBigEndian take them
+    // from the cache without parsing the file, while the file has
+    // the same size and either the same modification time or the same
+    // content hash. A stale or broken cache is ignored.
+    // The cache is found by the path of the file, not by its content,
+    // so a copy of the file at another path needs a cache of its own.
+    // In return a loading with a valid cache does not read the file,
+    // the file is hashed only if its modification time has changed.
+    static void saveCache( const char* elf_file_name);
+    // the same, but returns false with the error message instead of exiting
+    static bool saveCache( const char* elf_file_name, string& error /*used as output*/);
+    // The same, but the sections already loaded from the file are saved
+    // instead of parsing it again. The sections taken from the valid
+    // cache are not saved again at all.
+    static bool saveCache( const char* elf_file_name,
+                           const vector<ElfSection>& sections_array,
+                           string& error /*used as output*/);
+
+    // Use this function to extract the loadable segments (PT_LOAD)
+    // of the ELF binary file as the OS loads them. The segments are
+    // named "PT_LOAD" and have the SHF_* flags matching their PF_* ones.
+    static void getAllElfSegments( const char* elf_file_name,
+                                   vector<ElfSection>& segments_array /*used as output*/);
+
+    // Use this function to get the address the execution starts from.
+    static uint64 getEntryPoint( const char* elf_file_name);
+
+    // Use this function to find out the byte order of the ELF binary file.
+    static bool isBigEndian( const char* elf_file_name);
     
     virtual ~ElfSection();
     
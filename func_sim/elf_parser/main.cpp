@@ -2,29 +2,234 @@
 #include <string.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 // Generic C++
 #include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
 
 // uArchSim modules
 #include <elf_parser.h>
 
 using namespace std;
 
+// The files of a batch are taken by the workers one by one,
+// and their summaries are printed in the order of the files.
+struct Batch
+{
+    vector<string> files;
+    vector<string> summaries;
+    vector<char> is_done;
+    vector<char> is_failed;
+    size_t next_file; // the first file not taken by a worker
+    bool save_cache;  // the cache of each file is saved
+
+    pthread_mutex_t mutex;
+    pthread_cond_t done_cond; // signaled when a summary is done
+};
+
+// returns a line describing the sections of the file
+static string summarize( const string& file_name, bool save_cache,
+                         bool& is_failed /*is used as output*/)
+{
+    ostringstream oss;
+    oss << file_name << ": ";
+
+    vector<ElfSection> sections_array;
+    string error;
+    is_failed = !ElfSection::getAllElfSections( file_name.c_str(), sections_array, error) ||
+                ( save_cache && !ElfSection::saveCache( file_name.c_str(), sections_array, error));
+    if ( is_failed)
+    {
+        oss << "ERROR: " << error;
+        return oss.str();
+    }
+
+    uint64 bytes = 0;
+    for ( size_t i = 0; i < sections_array.size(); ++i)
+        bytes += sections_array[ i].size;
+
+    oss << sections_array.size() << " sections, " << bytes << " bytes";
+    for ( size_t i = 0; i < sections_array.size(); ++i)
+    {
+        oss << " " << sections_array[ i].name << "@0x" << hex << sections_array[ i].start_addr
+            << "+0x" << sections_array[ i].size << dec;
+    }
+
+    return oss.str();
+}
+
+static void* batchWorker( void* arg)
+{
+    Batch* batch = ( Batch*)arg;
+
+    for ( ;;)
+    {
+        size_t i = __atomic_fetch_add( &batch->next_file, 1, __ATOMIC_RELAXED);
+        if ( i >= batch->files.size())
+            return NULL;
+
+        bool is_failed;
+        string summary = summarize( batch->files[ i], batch->save_cache, is_failed);
+
+        pthread_mutex_lock( &batch->mutex);
+        batch->summaries[ i].swap( summary);
+        batch->is_failed[ i] = is_failed;
+        batch->is_done[ i] = true;
+        pthread_cond_signal( &batch->done_cond);
+        pthread_mutex_unlock( &batch->mutex);
+    }
+}
+
+// adds the file, the regular files of the directory or,
+// for "-", the files listed in the standard input
+static void addBatchFiles( const char* name, vector<string>& files /*is used as output*/)
+{
+    if ( strcmp( name, "-") == 0)
+    {
+        string line;
+        while ( getline( cin, line))
+            if ( !line.empty())
+                files.push_back( line);
+        return;
+    }
+
+    struct stat file_stat;
+    DIR* dir = stat( name, &file_stat) == 0 && S_ISDIR( file_stat.st_mode) ? opendir( name) : NULL;
+    if ( dir == NULL)
+    {
+        // the file which could not be read is reported in its summary
+        files.push_back( name);
+        return;
+    }
+
+    // the caches saved next to the files are not taken as files
+    const string cache_suffix = ".cache";
+
+    vector<string> dir_files;
+    for ( struct dirent* entry = readdir( dir); entry != NULL; entry = readdir( dir))
+    {
+        string file_name = string( name) + "/" + entry->d_name;
+        bool is_cache = file_name.size() > cache_suffix.size() &&
+                        file_name.compare( file_name.size() - cache_suffix.size(),
+                                           cache_suffix.size(), cache_suffix) == 0;
+        if ( entry->d_name[ 0] != '.' && !is_cache &&
+             stat( file_name.c_str(), &file_stat) == 0 && S_ISREG( file_stat.st_mode))
+        {
+            dir_files.push_back( file_name);
+        }
+    }
+    closedir( dir);
+
+    // the order of the directory entries is arbitrary
+    sort( dir_files.begin(), dir_files.end());
+    files.insert( files.end(), dir_files.begin(), dir_files.end());
+}
+
+// prints the summaries of all the files, returns false if any of them failed
+static bool runBatch( const vector<string>& files, long jobs_num, bool save_cache)
+{
+    Batch batch;
+    batch.files = files;
+    batch.save_cache = save_cache;
+    batch.summaries.resize( files.size());
+    batch.is_done.resize( files.size(), false);
+    batch.is_failed.resize( files.size(), false);
+    batch.next_file = 0;
+    pthread_mutex_init( &batch.mutex, NULL);
+    pthread_cond_init( &batch.done_cond, NULL);
+
+    vector<pthread_t> workers( max( 1L, min( jobs_num, ( long)files.size())));
+    for ( size_t i = 0; i < workers.size(); ++i)
+    {
+        if ( pthread_create( &workers[ i], NULL, batchWorker, &batch) != 0)
+        {
+            cerr << "ERROR: Could not create a worker thread" << endl;
+            exit( EXIT_FAILURE);
+        }
+    }
+
+    // the summaries are printed as soon as the previous ones are
+    bool is_failed = false;
+    for ( size_t i = 0; i < files.size(); ++i)
+    {
+        string summary;
+
+        pthread_mutex_lock( &batch.mutex);
+        while ( !batch.is_done[ i])
+            pthread_cond_wait( &batch.done_cond, &batch.mutex);
+        summary.swap( batch.summaries[ i]);
+        is_failed = is_failed || batch.is_failed[ i];
+        pthread_mutex_unlock( &batch.mutex);
+
+        cout << summary << endl;
+    }
+
+    for ( size_t i = 0; i < workers.size(); ++i)
+        pthread_join( workers[ i], NULL);
+
+    pthread_cond_destroy( &batch.done_cond);
+    pthread_mutex_destroy( &batch.mutex);
+
+    return !is_failed;
+}
+
 int main ( int argc, char* argv[])
 {
     const int num_of_args = 2;
-    
-    if ( argc == num_of_args && strcmp( argv[ 1],"--help"))
+
+    if ( argc >= num_of_args && strcmp( argv[ 1], "--batch") == 0)
+    {
+        // the workers are as many as the processors by default
+        long jobs_num = sysconf( _SC_NPROCESSORS_ONLN);
+        bool save_cache = false;
+        int first_file = 2;
+        for ( ;;)
+        {
+            if ( argc > first_file + 1 && strcmp( argv[ first_file], "--jobs") == 0)
+            {
+                jobs_num = atol( argv[ first_file + 1]);
+                first_file += 2;
+            } else if ( argc > first_file && strcmp( argv[ first_file], "--save-cache") == 0)
+            {
+                save_cache = true;
+                ++first_file;
+            } else
+            {
+                break;
+            }
+        }
+
+        vector<string> files;
+        for ( int i = first_file; i < argc; ++i)
+            addBatchFiles( argv[ i], files);
+
+        if ( jobs_num < 1 || files.empty())
+        {
+            cerr << "ERROR: no files or wrong number of jobs!" << endl
+                 << "Type \"" << argv[ 0] << " --help\" for usage." << endl;
+            exit( EXIT_FAILURE);
+        }
+
+        if ( !runBatch( files, jobs_num, save_cache))
+            exit( EXIT_FAILURE);
+
+    } else if ( argc == num_of_args && strcmp( argv[ 1],"--help"))
     {
         // extract all ELF sections into the section_array variable
         vector<ElfSection> sections_array;
         ElfSection::getAllElfSections( argv[1], sections_array);
-        
+
         // print the information about each section
         for ( int i = 0; i < sections_array.size(); ++i)
 	        cout << sections_array[ i].dump() << endl;
- 
+
     } else if ( argc != num_of_args)
     {
         cerr << "ERROR: wrong number of arguments!" << endl
@@ -36,7 +241,15 @@ int main ( int argc, char* argv[])
         cout << "This program prints content of all the sections" << endl
              << "of the ELF binary file, which name is given as only parameter." << endl
              << endl
-             << "Usage: \"" << argv[ 0] << " <ELF binary file>\"" << endl; 
+             << "Usage: \"" << argv[ 0] << " <ELF binary file>\"" << endl
+             << endl
+             << "In the batch mode it prints a line about the sections of each file," << endl
+             << "the files are parsed by several threads, one per processor by default." << endl
+             << "A directory stands for its files, \"-\" for the files listed in the input." << endl
+             << "With --save-cache the cache \"<file>.cache\" of each file is saved," << endl
+             << "so the next loadings of the file take its sections without parsing it." << endl
+             << endl
+             << "Usage: \"" << argv[ 0] << " --batch [--jobs <N>] [--save-cache] <files or directories>\"" << endl;
     }
 
     return 0;
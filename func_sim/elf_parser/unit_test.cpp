@@ -1,6 +1,16 @@
 // generic C
 #include <cassert>
 #include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <elf.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Generic C++
+#include <new>
 
 // Google Test library
 #include <gtest/gtest.h>
@@ -11,6 +21,30 @@
 static const char * valid_elf_file = "./mips_bin_exmpl.out";
 static const char * valid_section_name = ".data";
 
+// number of the objects allocated by the global operator new,
+// the loading tests run several threads
+static size_t new_calls = 0;
+
+void* operator new( size_t size)
+{
+    __atomic_fetch_add( &new_calls, 1, __ATOMIC_RELAXED);
+    void* ptr = malloc( size == 0 ? 1 : size);
+    if ( ptr == NULL)
+        throw std::bad_alloc();
+    return ptr;
+}
+
+void operator delete( void* ptr) throw()
+{
+    free( ptr);
+}
+
+// the sized form is used since C++14
+void operator delete( void* ptr, size_t) throw()
+{
+    free( ptr);
+}
+
 //
 // Check that all incorect input params of the constructor
 // are properly handled.
@@ -28,6 +62,334 @@ TEST( Elf_parser_init, Process_Wrong_Args_Of_Constr)
                  ::testing::ExitedWithCode( EXIT_FAILURE), "ERROR.*");
 }
 
+TEST( Elf_parser, Section_Flags)
+{
+    vector<ElfSection> sections_array;
+    ElfSection::getAllElfSections( valid_elf_file, sections_array);
+
+    for ( size_t i = 0; i < sections_array.size(); ++i)
+    {
+        const ElfSection& section = sections_array[ i];
+        if ( strcmp( section.name, ".text") == 0)
+        {
+            ASSERT_FALSE( section.isWritable());
+            ASSERT_TRUE( section.isExecutable());
+        } else if ( strcmp( section.name, valid_section_name) == 0)
+        {
+            ASSERT_TRUE( section.isWritable());
+            ASSERT_FALSE( section.isExecutable());
+        }
+    }
+}
+
+TEST( Elf_parser, Sections_Share_Mapping)
+{
+    vector<ElfSection> sections_array;
+    ElfSection::getAllElfSections( valid_elf_file, sections_array);
+    ASSERT_FALSE( sections_array.empty());
+
+    // the copy points to the same data and keeps it after the originals are gone
+    ElfSection section = sections_array[ 0];
+    ASSERT_EQ( section.content, sections_array[ 0].content);
+    ASSERT_EQ( section.name, sections_array[ 0].name);
+    string bytes = section.strByBytes();
+
+    sections_array.clear();
+    ASSERT_EQ( section.strByBytes(), bytes);
+
+    ElfSection::getAllElfSections( valid_elf_file, sections_array);
+    section = sections_array.back();
+    sections_array.clear();
+    ASSERT_EQ( section.size * 2, section.strByBytes().size());
+}
+
+TEST( Elf_parser, No_Allocation_Per_Section)
+{
+    vector<ElfSection> sections_array;
+
+    // only the array and the descriptor of the mapping are allocated
+    size_t calls_before = new_calls;
+    ElfSection::getAllElfSections( valid_elf_file, sections_array);
+    ASSERT_GT( sections_array.size(), 1u);
+    ASSERT_LE( new_calls - calls_before, 2u);
+
+    // the sections are moved or copied by reference into a new array
+    calls_before = new_calls;
+    sections_array.reserve( sections_array.capacity() * 2);
+    vector<ElfSection> copy = sections_array;
+    ASSERT_EQ( new_calls - calls_before, 2u);
+    ASSERT_EQ( copy.back().content, sections_array.back().content);
+}
+
+// returns the content of the section having the given name
+static string sectionBytes( const vector<ElfSection>& sections_array, const char* name)
+{
+    for ( size_t i = 0; i < sections_array.size(); ++i)
+        if ( strcmp( sections_array[ i].name, name) == 0)
+            return sections_array[ i].strByBytes();
+
+    return "";
+}
+
+TEST( Elf_parser, Sections_Cache)
+{
+    // the cache is made of a copy, so the copy can be changed
+    const char* elf_file = "./elf_cache_test.tmp";
+    const char* cache_file = "./elf_cache_test.tmp.cache";
+    {
+        FILE* src = fopen( valid_elf_file, "rb");
+        FILE* dst = fopen( elf_file, "wb");
+        ASSERT_TRUE( src != NULL && dst != NULL);
+        for ( int byte = fgetc( src); byte != EOF; byte = fgetc( src))
+            fputc( byte, dst);
+        fclose( src);
+        fclose( dst);
+    }
+
+    vector<ElfSection> parsed;
+    ElfSection::getAllElfSections( elf_file, parsed);
+    ElfSection::saveCache( elf_file);
+
+    vector<ElfSection> cached;
+    ElfSection::getAllElfSections( elf_file, cached);
+    ASSERT_EQ( cached.size(), parsed.size());
+    for ( size_t i = 0; i < parsed.size(); ++i)
+    {
+        ASSERT_STREQ( cached[ i].name, parsed[ i].name);
+        ASSERT_EQ( cached[ i].start_addr, parsed[ i].start_addr);
+        ASSERT_EQ( cached[ i].size, parsed[ i].size);
+        ASSERT_EQ( cached[ i].flags, parsed[ i].flags);
+        ASSERT_EQ( cached[ i].strByBytes(), parsed[ i].strByBytes());
+        ASSERT_FALSE( cached[ i].isBigEndian());
+        ASSERT_FALSE( parsed[ i].isBigEndian());
+    }
+    ASSERT_FALSE( ElfSection::isBigEndian( elf_file));
+
+    // the sections taken from the cache do not replace it
+    string error;
+    struct stat cache_stat;
+    ASSERT_EQ( stat( cache_file, &cache_stat), 0);
+    ino_t cache_inode = cache_stat.st_ino;
+    ASSERT_TRUE( ElfSection::saveCache( elf_file, cached, error));
+    ASSERT_EQ( stat( cache_file, &cache_stat), 0);
+    ASSERT_EQ( cache_stat.st_ino, cache_inode);
+
+    // while the parsed ones do
+    ASSERT_TRUE( ElfSection::saveCache( elf_file, parsed, error));
+    ASSERT_EQ( stat( cache_file, &cache_stat), 0);
+    ASSERT_NE( cache_stat.st_ino, cache_inode);
+
+    // a cache of a missing file is reported as an error
+    ASSERT_FALSE( ElfSection::saveCache( "./1234567890/qwertyuiop", error));
+    ASSERT_FALSE( error.empty());
+    ASSERT_EQ( ElfSection::getEntryPoint( elf_file), 0x4000b0u);
+
+    // the file touched without changes matches the content hash,
+    // then the cache takes its new time
+    struct stat elf_stat;
+    ASSERT_EQ( stat( elf_file, &elf_stat), 0);
+    struct timespec times[ 2] = { elf_stat.st_atim, elf_stat.st_mtim };
+    times[ 1].tv_sec -= 10;
+    ASSERT_EQ( utimensat( AT_FDCWD, elf_file, times, 0), 0);
+
+    cached.clear();
+    ElfSection::getAllElfSections( elf_file, cached);
+    ASSERT_EQ( cached.size(), parsed.size());
+
+    // the file is changed keeping its size and the new modification
+    // time, so the cache is still taken without checking the hash
+    string data = sectionBytes( parsed, valid_section_name);
+
+    FILE* file = fopen( elf_file, "r+b");
+    ASSERT_TRUE( file != NULL);
+    fseek( file, 0xc0, SEEK_SET); // the offset of ".data"
+    fputc( 0xa5, file);
+    fclose( file);
+
+    ASSERT_EQ( utimensat( AT_FDCWD, elf_file, times, 0), 0);
+
+    cached.clear();
+    ElfSection::getAllElfSections( elf_file, cached);
+    ASSERT_EQ( sectionBytes( cached, valid_section_name), data);
+
+    // with another time the content hash does not match
+    times[ 1].tv_sec += 1;
+    ASSERT_EQ( utimensat( AT_FDCWD, elf_file, times, 0), 0);
+
+    cached.clear();
+    ElfSection::getAllElfSections( elf_file, cached);
+    ASSERT_EQ( sectionBytes( cached, valid_section_name).substr( 0, 2), "a5");
+
+    // a broken cache is ignored
+    ASSERT_EQ( truncate( cache_file, 100), 0);
+    cached.clear();
+    ElfSection::getAllElfSections( elf_file, cached);
+    ASSERT_EQ( cached.size(), parsed.size());
+
+    remove( cache_file);
+    remove( elf_file);
+}
+
+TEST( Elf_parser, Sections_Without_Data_Cache)
+{
+    // an ELF having only a ".bss" of 2 TB and the names table
+    const char names[] = "\0.bss\0.shstrtab";
+    Elf64_Ehdr ehdr;
+    memset( &ehdr, 0, sizeof( ehdr));
+    memcpy( ehdr.e_ident, ELFMAG, SELFMAG);
+    ehdr.e_ident[ EI_CLASS] = ELFCLASS64;
+    ehdr.e_ident[ EI_DATA] = ELFDATA2LSB;
+    ehdr.e_ident[ EI_VERSION] = EV_CURRENT;
+    ehdr.e_type = ET_EXEC;
+    ehdr.e_machine = EM_MIPS;
+    ehdr.e_version = EV_CURRENT;
+    ehdr.e_shoff = sizeof( ehdr) + sizeof( uint64) * 2; // the names take 16 bytes
+    ehdr.e_ehsize = sizeof( ehdr);
+    ehdr.e_shentsize = sizeof( Elf64_Shdr);
+    ehdr.e_shnum = 3;
+    ehdr.e_shstrndx = 2;
+
+    Elf64_Shdr shdrs[ 3];
+    memset( shdrs, 0, sizeof( shdrs));
+    shdrs[ 1].sh_name = 1;
+    shdrs[ 1].sh_type = SHT_NOBITS;
+    shdrs[ 1].sh_flags = SHF_ALLOC | SHF_WRITE;
+    shdrs[ 1].sh_addr = 0x10000000;
+    shdrs[ 1].sh_offset = ehdr.e_shoff;
+    shdrs[ 1].sh_size = ( uint64)1 << 41;
+    shdrs[ 2].sh_name = 6;
+    shdrs[ 2].sh_type = SHT_STRTAB;
+    shdrs[ 2].sh_offset = sizeof( ehdr);
+    shdrs[ 2].sh_size = sizeof( names);
+
+    const char* elf_file = "./elf_bss_test.tmp";
+    const char* cache_file = "./elf_bss_test.tmp.cache";
+    FILE* file = fopen( elf_file, "wb");
+    ASSERT_TRUE( file != NULL);
+    fwrite( &ehdr, sizeof( ehdr), 1, file);
+    fwrite( names, 1, sizeof( names), file);
+    fwrite( shdrs, sizeof( shdrs), 1, file);
+    fclose( file);
+
+    // the section has no content at all
+    vector<ElfSection> sections_array;
+    ElfSection::getAllElfSections( elf_file, sections_array);
+    ASSERT_EQ( sections_array.size(), 1u);
+    ASSERT_STREQ( sections_array[ 0].name, ".bss");
+    ASSERT_EQ( sections_array[ 0].size, ( uint64)1 << 41);
+    ASSERT_EQ( sections_array[ 0].file_size, 0u);
+    ASSERT_TRUE( sections_array[ 0].content == NULL);
+
+    // the section is cached however large it is, so the cache
+    // is still taken after the address is changed in the file
+    ElfSection::saveCache( elf_file);
+
+    struct stat elf_stat;
+    ASSERT_EQ( stat( elf_file, &elf_stat), 0);
+    struct timespec times[ 2] = { elf_stat.st_atim, elf_stat.st_mtim };
+
+    shdrs[ 1].sh_addr = 0x20000000;
+    file = fopen( elf_file, "r+b");
+    ASSERT_TRUE( file != NULL);
+    fseek( file, ehdr.e_shoff, SEEK_SET);
+    fwrite( shdrs, sizeof( shdrs), 1, file);
+    fclose( file);
+    ASSERT_EQ( utimensat( AT_FDCWD, elf_file, times, 0), 0);
+
+    sections_array.clear();
+    ElfSection::getAllElfSections( elf_file, sections_array);
+    ASSERT_EQ( sections_array.size(), 1u);
+    ASSERT_EQ( sections_array[ 0].start_addr, 0x10000000u);
+    ASSERT_EQ( sections_array[ 0].size, ( uint64)1 << 41);
+    ASSERT_TRUE( sections_array[ 0].content == NULL);
+
+    remove( cache_file);
+    remove( elf_file);
+}
+
+TEST( Elf_parser, Loading_Errors_Are_Returned)
+{
+    vector<ElfSection> sections_array;
+    ElfSection::getAllElfSections( valid_elf_file, sections_array);
+    size_t sections_num = sections_array.size();
+
+    // the array is left as it was
+    string error;
+    ASSERT_FALSE( ElfSection::getAllElfSections( "./1234567890/qwertyuiop", sections_array, error));
+    ASSERT_EQ( sections_array.size(), sections_num);
+    ASSERT_NE( error.find( "Could not open"), string::npos);
+
+    // the file is not ELF
+    error.clear();
+    ASSERT_FALSE( ElfSection::getAllElfSections( "./unit_test.cpp", sections_array, error));
+    ASSERT_FALSE( error.empty());
+
+    // the names of the sections are not terminated within the table
+    const char* broken_file = "./elf_broken_names.tmp";
+    {
+        FILE* src = fopen( valid_elf_file, "rb");
+        FILE* dst = fopen( broken_file, "wb");
+        ASSERT_TRUE( src != NULL && dst != NULL);
+        for ( int byte = fgetc( src); byte != EOF; byte = fgetc( src))
+            fputc( byte, dst);
+        fclose( src);
+
+        fseek( dst, 0x180, SEEK_SET); // ".shstrtab" of 0x30 bytes
+        for ( int i = 0; i < 0x30; ++i)
+            fputc( 'x', dst);
+        fclose( dst);
+    }
+
+    error.clear();
+    ASSERT_FALSE( ElfSection::getAllElfSections( broken_file, sections_array, error));
+    ASSERT_EQ( sections_array.size(), sections_num);
+    ASSERT_FALSE( error.empty());
+    remove( broken_file);
+
+    ASSERT_TRUE( ElfSection::getAllElfSections( valid_elf_file, sections_array, error));
+    ASSERT_EQ( sections_array.size(), 2 * sections_num);
+}
+
+static const int LOADING_THREADS = 4;
+static const int LOADINGS_PER_THREAD = 50;
+
+// loads the file many times, returns non-NULL if a loading differs
+static void* loadManyTimes( void* arg)
+{
+    const string* expected = ( const string*)arg;
+
+    for ( int i = 0; i < LOADINGS_PER_THREAD; ++i)
+    {
+        vector<ElfSection> sections_array;
+        string error;
+        if ( !ElfSection::getAllElfSections( valid_elf_file, sections_array, error) ||
+             sectionBytes( sections_array, valid_section_name) != *expected)
+        {
+            return arg;
+        }
+    }
+
+    return NULL;
+}
+
+TEST( Elf_parser, Concurrent_Loading)
+{
+    vector<ElfSection> sections_array;
+    ElfSection::getAllElfSections( valid_elf_file, sections_array);
+    string expected = sectionBytes( sections_array, valid_section_name);
+
+    pthread_t threads[ LOADING_THREADS];
+    for ( int i = 0; i < LOADING_THREADS; ++i)
+        ASSERT_EQ( pthread_create( &threads[ i], NULL, loadManyTimes, &expected), 0);
+
+    for ( int i = 0; i < LOADING_THREADS; ++i)
+    {
+        void* result;
+        pthread_join( threads[ i], &result);
+        ASSERT_TRUE( result == NULL);
+    }
+}
+
 int main( int argc, char* argv[])
 {
     ::testing::InitGoogleTest( &argc, argv);
@@ -0,0 +1,78 @@
+/**
+ * bench.cpp - microbenchmark of random reads of the functional memory
+ * with and without huge pages backing the page storage.
+ * Copyright 2015 MIPT-MIPS iLab project
+ */
+
+// Generic C
+#include <cstdlib>
+#include <ctime>
+
+// Generic C++
+#include <iostream>
+
+// uArchSim modules
+#include <func_memory.h>
+
+using namespace std;
+
+static const char* huge_pages_names[] = { "none", "transparent", "reserved" };
+
+// returns the number of millions of reads per second
+static double measureRandomReads( const char* file_name, uint64 region_size,
+                                  uint64 num_of_reads, bool use_huge_pages)
+{
+    FuncMemory func_mem( file_name, 32, 10, 12, FuncMemory::PAGE_TABLE, use_huge_pages);
+
+    // a non-zero fill is needed to have private pages
+    const uint64 region_addr = 0x10000000;
+    func_mem.fill( 0x5a, region_addr, region_size);
+
+    // xorshift is used as it is cheap comparing with the read itself
+    uint64 state = 88172645463325252ULL;
+    uint64 sum = 0;
+
+    clock_t start = clock();
+    for ( uint64 i = 0; i < num_of_reads; ++i)
+    {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+
+        uint64 offset = ( state % region_size) & ~( uint64)( sizeof( uint32) - 1);
+        sum += func_mem.read<uint32>( region_addr + offset);
+    }
+    double seconds = ( double)( clock() - start) / CLOCKS_PER_SEC;
+
+    cout << "  huge pages requested: " << ( use_huge_pages ? "yes" : "no")
+         << ", obtained: " << huge_pages_names[ func_mem.hugePages()]
+         << ", TLB hits: " << func_mem.tlbHits()
+         << ", misses: " << func_mem.tlbMisses()
+         << " (checksum " << sum << ")" << endl;
+
+    return num_of_reads / seconds / 1e6;
+}
+
+int main( int argc, char* argv[])
+{
+    if ( argc < 2 || argc > 4)
+    {
+        cerr << "ERROR: wrong number of arguments!" << endl
+             << "Usage: \"" << argv[ 0]
+             << " <ELF binary file> [<region size in MB> [<millions of reads>]]\"" << endl;
+        exit( EXIT_FAILURE);
+    }
+
+    uint64 region_size = ( argc > 2 ? strtoull( argv[ 2], NULL, 0) : 256) * 1024 * 1024;
+    uint64 num_of_reads = ( argc > 3 ? strtoull( argv[ 3], NULL, 0) : 20) * 1000 * 1000;
+
+    double base = measureRandomReads( argv[ 1], region_size, num_of_reads, false);
+    cout << "  " << base << " M reads/s" << endl;
+
+    double huge = measureRandomReads( argv[ 1], region_size, num_of_reads, true);
+    cout << "  " << huge << " M reads/s" << endl;
+
+    cout << "Speed-up with huge pages: " << huge / base << endl;
+
+    return 0;
+}
@@ -0,0 +1,123 @@
+#
+# el2eb.py - Converts a little-endian MIPS ELF binary into the big-endian one
+# Copyright 2015 MIPT-MIPS iLab project
+#
+# Usage: python3 el2eb.py <source.s> <little-endian.out> <big-endian.out>
+#
+# The output is what the assembler and the linker make of the same source
+# with -EB: the ELF structures, the instructions and the data items are
+# byte-swapped, the strings and the bytes are left as they are. The widths
+# of the data items are taken from the directives of the source, so it must
+# be the one the little-endian binary is built from.
+#
+
+import struct
+import sys
+
+# widths of the data items in bytes by the directives
+DATA_WIDTHS = { '.byte': 1, '.half': 2, '.word': 4 }
+
+def fail( message):
+    sys.stderr.write( 'ERROR: ' + message + '\n')
+    sys.exit( 1)
+
+# returns the (offset, width) of each item of the data section
+def parse_data_items( source_file_name):
+    items = []
+    offset = 0
+    in_data = False
+
+    for line in open( source_file_name):
+        line = line.split( '#')[ 0].strip()
+
+        # the labels are skipped, the directive follows them
+        while ':' in line:
+            line = line.split( ':', 1)[ 1].strip()
+        if not line:
+            continue
+
+        words = line.split( None, 1)
+        directive = words[ 0]
+        args = [ arg.strip() for arg in words[ 1].split( ',')] if len( words) > 1 else []
+
+        if directive in ( '.data', '.text', '.rdata', '.sdata'):
+            in_data = directive == '.data'
+        elif not in_data:
+            continue
+        elif directive in DATA_WIDTHS:
+            # the assembler aligns the items by their width
+            width = DATA_WIDTHS[ directive]
+            offset = ( offset + width - 1) // width * width
+            for arg in args:
+                items.append( ( offset, width))
+                offset += width
+        elif directive == '.space':
+            offset += int( args[ 0], 0)
+        elif directive == '.align':
+            align = 1 << int( args[ 0], 0)
+            offset = ( offset + align - 1) // align * align
+        elif directive in ( '.ascii', '.asciiz'):
+            fail( 'strings are not supported in ' + source_file_name)
+        else:
+            fail( 'unknown directive ' + directive + ' in ' + source_file_name)
+
+    return items
+
+def main():
+    if len( sys.argv) != 4:
+        fail( 'usage: el2eb.py <source.s> <little-endian.out> <big-endian.out>')
+
+    data_items = parse_data_items( sys.argv[ 1])
+    elf = bytearray( open( sys.argv[ 2], 'rb').read())
+
+    if elf[ :4] != b'\x7fELF' or elf[ 4] != 1 or elf[ 5] != 1:
+        fail( sys.argv[ 2] + ' is not a 32-bit little-endian ELF file')
+
+    # swaps the fields of the given format at the offset
+    def swap( offset, fields):
+        values = struct.unpack_from( '<' + fields, elf, offset)
+        struct.pack_into( '>' + fields, elf, offset, *values)
+
+    ehdr_fields = 'HHIIIIIHHHHHH'
+    ( e_type, e_machine, e_version, e_entry, e_phoff, e_shoff, e_flags, e_ehsize,
+      e_phentsize, e_phnum, e_shentsize, e_shnum, e_shstrndx) = \
+        struct.unpack_from( '<' + ehdr_fields, elf, 16)
+
+    shdrs = [ struct.unpack_from( '<10I', elf, e_shoff + i * e_shentsize)
+              for i in range( e_shnum)]
+    names_offset = shdrs[ e_shstrndx][ 4]
+
+    def section_name( shdr):
+        start = names_offset + shdr[ 0]
+        return elf[ start:elf.index( 0, start)].decode()
+
+    for shdr in shdrs:
+        name = section_name( shdr)
+        sh_type, offset, size, entsize = shdr[ 1], shdr[ 4], shdr[ 5], shdr[ 9]
+
+        if name in ( '.text', '.reginfo'):
+            # instructions and the register masks are words
+            for word in range( offset, offset + size, 4):
+                swap( word, 'I')
+        elif name == '.data':
+            for item_offset, width in data_items:
+                if item_offset + width > size:
+                    fail( 'the source does not match .data of ' + sys.argv[ 2])
+                if width > 1:
+                    swap( offset + item_offset, { 2: 'H', 4: 'I'}[ width])
+        elif name == '.symtab':
+            for symbol in range( offset, offset + size, entsize):
+                swap( symbol, 'IIIBBH')
+        elif sh_type not in ( 0, 3, 8): # NULL, STRTAB and NOBITS have nothing to swap
+            fail( 'section ' + name + ' of ' + sys.argv[ 2] + ' is not supported')
+
+    swap( 16, ehdr_fields)
+    for i in range( e_phnum):
+        swap( e_phoff + i * e_phentsize, '8I')
+    for i in range( e_shnum):
+        swap( e_shoff + i * e_shentsize, '10I')
+    elf[ 5] = 2 # ELFDATA2MSB
+
+    open( sys.argv[ 3], 'wb').write( elf)
+
+main()
@@ -6,44 +6,1498 @@
  */
 
 // Generic C
+#include <cstdlib>
+#include <cstring>
+#include <sys/mman.h>
 
 // Generic C++
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <map>
+#include <algorithm>
 
 // uArchSim modules
 #include <func_memory.h>
 
+// returns a mask having the given number of least significant bits set
+static uint64 lowBitsMask( uint64 num_of_bits)
+{
+    return num_of_bits >= 64 ? MAX_VAL64 : ( ( uint64)1 << num_of_bits) - 1;
+}
+
+// frees the per-set arrays kept by the tree and removes them
+static void freeSetArrays( RadixTree* tree)
+{
+    uint64 set = 0;
+    for ( void* array = tree->findNext( set); array != NULL; array = tree->findNext( ++set))
+        free( array);
+
+    tree->clear();
+}
+
+// checks that all the bytes of the block are zero
+static bool isZeroBlock( const uint8* data, uint64 size)
+{
+    uint64 i = 0;
+    for ( ; i + sizeof( uint64) <= size; i += sizeof( uint64))
+    {
+        uint64 word;
+        memcpy( &word, data + i, sizeof( uint64));
+        if ( word != 0)
+            return false;
+    }
+
+    for ( ; i < size; ++i)
+        if ( data[ i] != 0)
+            return false;
+
+    return true;
+}
+
 FuncMemory::FuncMemory( const char* executable_file_name,
                         uint64 addr_size,
                         uint64 page_bits,
-                        uint64 offset_bits)
+                        uint64 offset_bits,
+                        Backend backend,
+                        bool use_huge_pages,
+                        bool protect_sections,
+                        bool load_segments)
 {
-    // put your code here
+    this->init( addr_size, page_bits, offset_bits, backend, use_huge_pages);
+
+    // the segments are loaded the same way as the sections
+    vector<ElfSection> sections_array;
+    if ( load_segments)
+    {
+        ElfSection::getAllElfSegments( executable_file_name, sections_array);
+        this->start_pc = ElfSection::getEntryPoint( executable_file_name);
+    } else
+    {
+        ElfSection::getAllElfSections( executable_file_name, sections_array);
+    }
+
+    // the file is not opened again to learn its byte order
+    if ( !sections_array.empty() && sections_array[ 0].isBigEndian())
+        this->byte_order = BIG_ENDIAN_ORDER;
+
+    // a page shared by several sections gets the permissions of all of them
+    map<uint64, uint32> page_perms;
+
+    for ( size_t i = 0; i < sections_array.size(); ++i)
+    {
+        const ElfSection& section = sections_array[ i];
+
+        if ( strcmp( section.name, ".text") == 0)
+            this->start_pc = section.start_addr;
+
+        this->writeBlock( section.content, section.start_addr, section.file_size);
+        this->fill( 0, section.start_addr + section.file_size, section.size - section.file_size);
+
+        uint32 perms = PERM_READ | ( section.isWritable() ? PERM_WRITE : 0) |
+                                   ( section.isExecutable() ? PERM_EXEC : 0);
+        uint64 first_tag = section.start_addr >> this->offset_bits;
+        uint64 last_tag = ( section.start_addr + section.size - 1) >> this->offset_bits;
+        for ( uint64 tag = first_tag; section.size > 0 && tag <= last_tag; ++tag)
+            page_perms[ tag] |= perms;
+    }
+
+    // the sections are protected once all of them are written
+    if ( protect_sections)
+    {
+        for ( map<uint64, uint32>::const_iterator it = page_perms.begin();
+              it != page_perms.end(); ++it)
+        {
+            this->setPermissions( it->first << this->offset_bits, this->page_size, it->second);
+        }
+    }
+
+    // the loading is not an access of the guest
+    this->clearHeatMap();
+}
+
+void FuncMemory::init( uint64 addr_size,
+                       uint64 page_bits,
+                       uint64 offset_bits,
+                       Backend backend,
+                       bool use_huge_pages)
+{
+    // the pages are at most 4GB, larger ones could not be even allocated
+    if ( addr_size > 64 || offset_bits == 0 || offset_bits > 32 ||
+         page_bits + offset_bits > addr_size ||
+         page_bits >= 32 ||
+         ( backend == FLAT_MAPPING && addr_size > 32))
+    {
+        cerr << "ERROR: wrong memory configuration: addr_size = " << addr_size
+             << ", page_num_size = " << page_bits
+             << ", offset_size = " << offset_bits << endl;
+        exit( EXIT_FAILURE);
+    }
+
+    this->addr_size = addr_size;
+    this->page_bits = page_bits;
+    this->offset_bits = offset_bits;
+    this->set_bits = addr_size - page_bits - offset_bits;
+
+    this->addr_mask = lowBitsMask( addr_size);
+    this->page_mask = lowBitsMask( page_bits);
+    this->offset_mask = lowBitsMask( offset_bits);
+
+    this->pages_num = ( uint64)1 << this->page_bits;
+    this->page_size = ( uint64)1 << this->offset_bits;
+    this->tags_num = ( uint64)1 << ( this->addr_size - this->offset_bits);
+
+    this->start_pc = NO_VAL64;
+    this->byte_order = LITTLE_ENDIAN_ORDER;
+
+    this->flushTlb();
+    this->tlb_hits = 0;
+    this->tlb_misses = 0;
+
+    this->sets = NULL;
+    this->flat_base = NULL;
+    this->flat_pages = NULL;
+
+    // the arena links the free blocks through them, so a tiny page takes a word
+    this->page_arena = new PageArena( max( this->page_size, ( uint64)sizeof( void*)),
+                                      PageArena::DEFAULT_CHUNK_SIZE,
+                                      use_huge_pages);
+    this->page_info_arena = new PageArena( sizeof( Page));
+    this->shadow_arena = new PageArena( ( this->page_size + 63) / 64 * sizeof( uint64));
+    for ( uint32 perms = 0; perms <= PERM_ALL; ++perms)
+        this->zero_pages[ perms] = NULL;
+    this->image_base = NULL;
+    this->image_size = 0;
+    this->arenas_locked = false;
+
+    this->watched_sets = NULL;
+    this->in_watch_callback = false;
+
+    this->heat_sets = FUNC_MEMORY_HEAT_COUNT ? new RadixTree( this->set_bits) : NULL;
+
+    if ( backend == FLAT_MAPPING)
+    {
+        // MAP_NORESERVE makes the OS to commit host memory
+        // only for the touched part of the reservation
+        void* base = mmap( NULL, this->addr_mask + 1, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        this->flat_pages = ( Page*)calloc( this->tags_num, sizeof( Page));
+        if ( base == MAP_FAILED || this->flat_pages == NULL)
+        {
+            cerr << "ERROR: could not reserve " << ( this->addr_mask + 1)
+                 << " bytes of the host memory" << endl;
+            exit( EXIT_FAILURE);
+        }
+        this->flat_base = ( uint8*)base;
+
+        // the mapping is too large to be taken from reserved huge pages
+        this->flat_huge_pages = PageArena::HUGE_PAGES_NONE;
+#ifdef MADV_HUGEPAGE
+        if ( use_huge_pages && madvise( base, this->addr_mask + 1, MADV_HUGEPAGE) == 0)
+            this->flat_huge_pages = PageArena::HUGE_PAGES_TRANSPARENT;
+#endif
+    } else
+    {
+        // only the root of the set table is allocated in advance
+        this->sets = new RadixTree( this->set_bits);
+
+        // the memory itself holds a reference, so the page is never copied
+        // into a private one in place, i.e. it is always copied on write
+        this->zero_pages[ PERM_ALL] = this->allocPage();
+    }
+
+    // the first checkpoint has to save the whole memory
+    this->dirty_sets = NULL;
+    this->flat_dirty = NULL;
+    if ( backend == FLAT_MAPPING)
+    {
+        this->dirty_words_num = ( this->tags_num + 63) / 64;
+        this->flat_dirty = ( uint64*)calloc( this->dirty_words_num, sizeof( uint64));
+        assert( this->flat_dirty != NULL);
+    } else
+    {
+        this->dirty_words_num = ( this->pages_num + 63) / 64;
+        this->dirty_sets = new RadixTree( this->set_bits);
+    }
+    this->checkpoint_full = true;
 }
 
 FuncMemory::~FuncMemory()
 {
-    // put your code here
+    if ( this->flat_pages != NULL)
+    {
+        munmap( this->flat_base, this->addr_mask + 1);
+        free( this->flat_pages);
+    } else
+    {
+        this->releaseSets( this->sets);
+        for ( uint32 perms = 0; perms <= PERM_ALL; ++perms)
+            if ( this->zero_pages[ perms] != NULL)
+                this->releasePage( this->zero_pages[ perms]);
+    }
+
+    // all the pages are returned to the host at once
+    delete this->page_arena;
+    delete this->page_info_arena;
+    delete this->shadow_arena;
+
+    if ( this->image_base != NULL)
+        munmap( this->image_base, this->image_size);
+
+    if ( this->dirty_sets != NULL)
+    {
+        freeSetArrays( this->dirty_sets);
+        delete this->dirty_sets;
+    }
+    free( this->flat_dirty);
+
+    if ( this->watched_sets != NULL)
+    {
+        freeSetArrays( this->watched_sets);
+        delete this->watched_sets;
+    }
+
+    if ( this->heat_sets != NULL)
+    {
+        freeSetArrays( this->heat_sets);
+        delete this->heat_sets;
+    }
+}
+
+FuncMemory::Page* FuncMemory::getPage( uint64 addr) const
+{
+    if ( this->flat_pages != NULL)
+    {
+        Page* page = &this->flat_pages[ addr >> this->offset_bits];
+        return page->data == NULL ? NULL : page;
+    }
+
+    Page** pages = ( Page**)this->sets->find( this->getSetNum( addr));
+    return pages == NULL ? NULL : pages[ this->getPageNum( addr)];
+}
+
+FuncMemory::Page** FuncMemory::getOrAllocDir( uint64 addr)
+{
+    void** dir = this->sets->slot( this->getSetNum( addr));
+    if ( *dir == NULL)
+    {
+        *dir = calloc( this->pages_num, sizeof( Page*));
+        assert( *dir != NULL);
+    }
+    return ( Page**)*dir;
+}
+
+FuncMemory::Page* FuncMemory::getOrAllocPage( uint64 addr)
+{
+    if ( this->flat_pages != NULL)
+    {
+        // the page is already in the mapping, just mark it as written
+        uint64 tag = addr >> this->offset_bits;
+        Page* page = &this->flat_pages[ tag];
+        if ( page->data == NULL)
+        {
+            page->data = this->flat_base + ( tag << this->offset_bits);
+            page->ref_count = 1;
+            page->perms = PERM_ALL;
+            page->shadow = this->allocShadow();
+        }
+
+        this->setDirty( tag);
+        return page;
+    }
+
+    Page** pages = this->getOrAllocDir( addr);
+    Page*& page = pages[ this->getPageNum( addr)];
+    if ( page == NULL)
+    {
+        page = this->allocPage();
+        page->shadow = this->allocShadow();
+    } else if ( page->ref_count > 1)
+    {
+        // the page is shared with a snapshot or it is a zero page,
+        // so copy it on write
+        Page* copy = this->allocPage( page);
+        this->releasePage( page);
+        page = copy;
+    }
+
+    this->setDirty( addr >> this->offset_bits);
+    return page;
+}
+
+void FuncMemory::mapZeroPage( uint64 addr)
+{
+    uint64 tag = addr >> this->offset_bits;
+
+    if ( this->watched_sets != NULL && this->isWatched( tag))
+        this->checkWatchpoints( tag << this->offset_bits, this->page_size, true);
+
+    Page* old_page = this->getPage( addr);
+    if ( old_page != NULL && ( old_page->perms & PERM_WRITE) == 0)
+        this->accessFault( addr, PERM_WRITE);
+
+    if ( this->flat_pages != NULL)
+    {
+        // not touched pages of the mapping are zero pages of the OS
+        Page* page = this->getPage( addr);
+        if ( page != NULL)
+            memset( page->data, 0, this->page_size);
+
+        // mark the page as written and dirty
+        page = this->getOrAllocPage( addr);
+        this->markInitialized( page->shadow, tag << this->offset_bits, this->page_size);
+        return;
+    }
+
+    // the page keeps its permissions
+    Page* zero_page = this->zeroPage( old_page != NULL ? old_page->perms : ( uint32)PERM_ALL);
+    ++zero_page->ref_count;
+
+    Page** pages = this->getOrAllocDir( addr);
+    Page*& page = pages[ this->getPageNum( addr)];
+    if ( page != NULL)
+        this->releasePage( page);
+    page = zero_page;
+
+    this->setDirty( tag);
+
+    // the cached translation could refer to the released page
+    TlbEntry& entry = this->tlb[ tag & ( TLB_SIZE - 1)];
+    if ( entry.tag == tag)
+        entry.tag = NO_VAL64;
+}
+
+FuncMemory::Page* FuncMemory::zeroPage( uint32 perms)
+{
+    assert( ( perms & ~PERM_ALL) == 0);
+
+    Page*& page = this->zero_pages[ perms];
+    if ( page == NULL)
+    {
+        page = this->allocPage();
+        page->perms = perms;
+    }
+    return page;
+}
+
+bool FuncMemory::isZeroPage( const Page* page) const
+{
+    return this->flat_pages == NULL && page == this->zero_pages[ page->perms];
+}
+
+uint64* FuncMemory::allocShadow( const uint64* content)
+{
+    if ( !FUNC_MEMORY_INIT_CHECK)
+        return NULL;
+
+    uint64* shadow = ( uint64*)this->shadow_arena->allocate( content == NULL);
+    if ( content != NULL)
+        memcpy( shadow, content, this->shadow_arena->blockSize());
+
+    return shadow;
+}
+
+void FuncMemory::markInitialized( uint64* shadow, uint64 addr, uint64 size)
+{
+    if ( !FUNC_MEMORY_INIT_CHECK || shadow == NULL)
+        return;
+
+    if ( size < this->page_size)
+    {
+        setInitialized( shadow, this->getOffset( addr), size);
+        return;
+    }
+
+    // the whole page is written, so the bitmap is not needed anymore
+    uint64 tag = addr >> this->offset_bits;
+    Page* page = this->getPage( addr);
+    assert( page->shadow == shadow && page->ref_count == 1);
+
+    this->releaseShadow( shadow);
+    page->shadow = NULL;
+
+    TlbEntry& entry = this->tlb[ tag & ( TLB_SIZE - 1)];
+    if ( entry.tag == tag)
+        entry.shadow = NULL;
+}
+
+bool FuncMemory::isImageMemory( const void* ptr) const
+{
+    return this->image_base != NULL && ptr >= this->image_base &&
+           ptr < this->image_base + this->image_size;
+}
+
+void FuncMemory::releaseShadow( uint64* shadow)
+{
+    if ( shadow != NULL && !this->isImageMemory( shadow))
+        this->shadow_arena->release( shadow);
+}
+
+void FuncMemory::setDirty( uint64 tag)
+{
+    if ( this->flat_dirty != NULL)
+    {
+        this->flat_dirty[ tag / 64] |= ( uint64)1 << ( tag % 64);
+        return;
+    }
+
+    void** slot = this->dirty_sets->slot( tag >> this->page_bits);
+    if ( *slot == NULL)
+    {
+        *slot = calloc( this->dirty_words_num, sizeof( uint64));
+        assert( *slot != NULL);
+    }
+
+    uint64* dirty = ( uint64*)*slot;
+    uint64 page_num = tag & this->page_mask;
+    dirty[ page_num / 64] |= ( uint64)1 << ( page_num % 64);
+}
+
+void FuncMemory::clearDirty()
+{
+    if ( this->flat_dirty != NULL)
+    {
+        memset( this->flat_dirty, 0, this->dirty_words_num * sizeof( uint64));
+    } else
+    {
+        uint64 set = 0;
+        for ( void* dirty = this->dirty_sets->findNext( set); dirty != NULL;
+              dirty = this->dirty_sets->findNext( ++set))
+        {
+            memset( dirty, 0, this->dirty_words_num * sizeof( uint64));
+        }
+    }
+
+    this->checkpoint_full = false;
+
+    // the cached translations for writes skip the dirty marking
+    this->flushTlb();
+}
+
+uint64 FuncMemory::arenaPeakFootprint() const
+{
+    return this->page_arena->footprint() + this->page_info_arena->footprint() +
+           this->shadow_arena->footprint();
+}
+
+PageArena::HugePages FuncMemory::hugePages() const
+{
+    if ( this->flat_pages != NULL)
+        return this->flat_huge_pages;
+
+    return this->page_arena->hugePages();
+}
+
+uint64 FuncMemory::dirtyPagesNum() const
+{
+    uint64 num = 0;
+    uint64 tag = 0;
+    for ( const Page* page = this->findPage( tag); page != NULL;
+          page = this->findPage( ++tag))
+    {
+        if ( this->checkpoint_full || this->isDirty( tag))
+            ++num;
+    }
+
+    return num;
+}
+
+void FuncMemory::clear()
+{
+    if ( this->flat_pages != NULL)
+    {
+        uint64 tag = 0;
+        for ( const Page* page = this->findPage( tag); page != NULL;
+              page = this->findPage( ++tag))
+        {
+            this->releaseShadow( page->shadow);
+        }
+
+        // Return the host memory of the mapping to the OS, it will
+        // be given back zeroed if the guest touches it again. The range
+        // is mapped anew as some pages could be mapped from an image.
+        void* base = mmap( this->flat_base, this->addr_mask + 1, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+        if ( base == MAP_FAILED)
+        {
+            cerr << "ERROR: could not remap " << ( this->addr_mask + 1)
+                 << " bytes of the host memory" << endl;
+            exit( EXIT_FAILURE);
+        }
+#ifdef MADV_HUGEPAGE
+        if ( this->flat_huge_pages == PageArena::HUGE_PAGES_TRANSPARENT)
+            madvise( base, this->addr_mask + 1, MADV_HUGEPAGE);
+#endif
+        memset( this->flat_pages, 0, this->tags_num * sizeof( Page));
+    } else
+    {
+        this->releaseSets( this->sets);
+        this->sets = new RadixTree( this->set_bits);
+    }
+
+    this->flushTlb();
+}
+
+FuncMemory::Page* FuncMemory::allocPage( const Page* original)
+{
+    bool is_zero = original == NULL || this->isZeroPage( original);
+
+    Page* page = ( Page*)this->page_info_arena->allocate( false);
+    page->ref_count = 1;
+    page->data = this->page_arena->allocate( is_zero);
+    page->shadow = NULL;
+    page->perms = original == NULL ? ( uint32)PERM_ALL : original->perms;
+
+    if ( !is_zero)
+    {
+        memcpy( page->data, original->data, this->page_size);
+        if ( original->shadow != NULL)
+            page->shadow = this->allocShadow( original->shadow);
+    }
+
+    return page;
+}
+
+void FuncMemory::releasePage( Page* page)
+{
+    assert( page->ref_count > 0);
+    if ( --page->ref_count > 0)
+        return;
+
+    this->freePage( page);
+}
+
+void FuncMemory::freePage( Page* page)
+{
+    if ( !this->isImageMemory( page->data))
+        this->page_arena->release( page->data);
+    this->releaseShadow( page->shadow);
+    this->page_info_arena->release( page);
+}
+
+void FuncMemory::lockArenas()
+{
+    while ( __atomic_test_and_set( &this->arenas_locked, __ATOMIC_ACQUIRE))
+        ;
+}
+
+void FuncMemory::unlockArenas()
+{
+    __atomic_clear( &this->arenas_locked, __ATOMIC_RELEASE);
+}
+
+FuncMemory::Page* FuncMemory::getPageShared( uint64 addr) const
+{
+    if ( this->flat_pages != NULL)
+    {
+        Page* page = &this->flat_pages[ addr >> this->offset_bits];
+        return MultiThreaded::load( &page->data) == NULL ? NULL : page;
+    }
+
+    Page** pages = ( Page**)this->sets->findShared( this->getSetNum( addr));
+    return pages == NULL ? NULL : MultiThreaded::load( &pages[ this->getPageNum( addr)]);
+}
+
+FuncMemory::Page* FuncMemory::getOrAllocPageShared( uint64 addr)
+{
+    uint64 tag = addr >> this->offset_bits;
+
+    if ( this->flat_pages != NULL)
+    {
+        // The thread setting the reference count marks the page as written,
+        // the others wait for it. The data pointer is set the last, as
+        // the page is treated as written once it is not NULL.
+        Page* page = &this->flat_pages[ tag];
+        if ( MultiThreaded::load( &page->data) == NULL)
+        {
+            uint32 ref_count = 0;
+            if ( MultiThreaded::compareAndSwap( &page->ref_count, ref_count, ( uint32)1))
+            {
+                this->lockArenas();
+                page->shadow = this->allocShadow();
+                this->unlockArenas();
+                page->perms = PERM_ALL;
+
+                MultiThreaded::store( &page->data, this->flat_base + ( tag << this->offset_bits));
+            } else
+            {
+                while ( MultiThreaded::load( &page->data) == NULL)
+                    ;
+            }
+        }
+
+        this->setDirtyShared( tag);
+        return page;
+    }
+
+    void** dir = this->sets->slotShared( this->getSetNum( addr));
+    Page** pages = ( Page**)MultiThreaded::load( dir);
+    if ( pages == NULL)
+    {
+        Page** new_pages = ( Page**)calloc( this->pages_num, sizeof( Page*));
+        assert( new_pages != NULL);
+
+        void* installed = NULL;
+        if ( MultiThreaded::compareAndSwap( dir, installed, ( void*)new_pages))
+        {
+            pages = new_pages;
+        } else
+        {
+            pages = ( Page**)installed;
+            free( new_pages);
+        }
+    }
+
+    Page** slot = &pages[ this->getPageNum( addr)];
+    Page* page = MultiThreaded::load( slot);
+
+    // the page is not allocated yet or it is shared, so install a private one
+    while ( page == NULL || MultiThreaded::load( &page->ref_count) > 1)
+    {
+        this->lockArenas();
+        Page* copy = this->allocPage( page);
+        if ( page == NULL)
+            copy->shadow = this->allocShadow();
+        this->unlockArenas();
+
+        Page* old_page = page;
+        if ( MultiThreaded::compareAndSwap( slot, page, copy))
+        {
+            if ( old_page != NULL)
+                this->releasePageShared( old_page);
+            page = copy;
+            break;
+        }
+
+        // another thread has installed its page, so use it
+        this->releasePageShared( copy);
+    }
+
+    this->setDirtyShared( tag);
+    return page;
+}
+
+void FuncMemory::releasePageShared( Page* page)
+{
+    if ( MultiThreaded::fetchAdd( &page->ref_count, ( uint32)-1) > 1)
+        return;
+
+    this->lockArenas();
+    this->freePage( page);
+    this->unlockArenas();
+}
+
+void FuncMemory::setDirtyShared( uint64 tag)
+{
+    // the bitmap of the flat mapping is indexed by the tag itself
+    uint64* dirty = this->flat_dirty;
+    uint64 page_num = tag;
+
+    if ( dirty == NULL)
+    {
+        void** slot = this->dirty_sets->slotShared( tag >> this->page_bits);
+        dirty = ( uint64*)MultiThreaded::load( slot);
+        if ( dirty == NULL)
+        {
+            uint64* new_dirty = ( uint64*)calloc( this->dirty_words_num, sizeof( uint64));
+            assert( new_dirty != NULL);
+
+            void* installed = NULL;
+            if ( MultiThreaded::compareAndSwap( slot, installed, ( void*)new_dirty))
+            {
+                dirty = new_dirty;
+            } else
+            {
+                dirty = ( uint64*)installed;
+                free( new_dirty);
+            }
+        }
+        page_num = tag & this->page_mask;
+    }
+
+    // the atomic update is skipped for pages already dirty
+    uint64 bit = ( uint64)1 << ( page_num % 64);
+    if ( ( MultiThreaded::load( &dirty[ page_num / 64]) & bit) == 0)
+        MultiThreaded::setBits( &dirty[ page_num / 64], bit);
+}
+
+RadixTree* FuncMemory::copySets( const RadixTree* sets)
+{
+    RadixTree* copy = new RadixTree( this->set_bits);
+
+    uint64 set = 0;
+    for ( const void* pages = sets->findNext( set); pages != NULL;
+          pages = sets->findNext( ++set))
+    {
+        Page** copy_pages = ( Page**)malloc( this->pages_num * sizeof( Page*));
+        assert( copy_pages != NULL);
+        memcpy( copy_pages, pages, this->pages_num * sizeof( Page*));
+
+        for ( uint64 page_num = 0; page_num < this->pages_num; ++page_num)
+            if ( copy_pages[ page_num] != NULL)
+                ++copy_pages[ page_num]->ref_count;
+
+        *copy->slot( set) = copy_pages;
+    }
+
+    return copy;
+}
+
+void FuncMemory::releaseSets( RadixTree* sets)
+{
+    uint64 set = 0;
+    for ( void* dir = sets->findNext( set); dir != NULL; dir = sets->findNext( ++set))
+    {
+        Page** pages = ( Page**)dir;
+        for ( uint64 page_num = 0; page_num < this->pages_num; ++page_num)
+            if ( pages[ page_num] != NULL)
+                this->releasePage( pages[ page_num]);
+
+        free( pages);
+    }
+    delete sets;
+}
+
+FuncMemory::Snapshot* FuncMemory::snapshot()
+{
+    // pages of the flat mapping cannot be shared
+    assert( this->flat_pages == NULL);
+
+    // all the pages become shared, so the cached
+    // translations cannot be used for writes anymore
+    this->flushTlb();
+
+    return new Snapshot( this, this->copySets( this->sets));
+}
+
+void FuncMemory::restore( const Snapshot& snapshot)
+{
+    assert( snapshot.memory == this);
+
+    RadixTree* old_sets = this->sets;
+    this->sets = this->copySets( snapshot.sets);
+    this->releaseSets( old_sets);
+
+    // pages could disappear, so the next checkpoint saves everything
+    this->checkpoint_full = true;
+
+    this->flushTlb();
+}
+
+FuncMemory::Snapshot::~Snapshot()
+{
+    this->memory->releaseSets( this->sets);
+}
+
+const FuncMemory::Page* FuncMemory::findPage( uint64& tag) const
+{
+    if ( this->flat_pages != NULL)
+    {
+        for ( ; tag < this->tags_num; ++tag)
+            if ( this->flat_pages[ tag].data != NULL)
+                return &this->flat_pages[ tag];
+
+        return NULL;
+    }
+
+    while ( tag < this->tags_num)
+    {
+        // the sets having no page directory are skipped by the tree
+        uint64 set = tag >> this->page_bits;
+        const Page* const* pages = ( const Page* const*)this->sets->findNext( set);
+        if ( pages == NULL)
+            return NULL;
+
+        if ( set != tag >> this->page_bits)
+            tag = set << this->page_bits;
+
+        for ( uint64 page_num = tag & this->page_mask;
+              page_num < this->pages_num; ++page_num, ++tag)
+        {
+            if ( pages[ page_num] != NULL)
+                return pages[ page_num];
+        }
+    }
+
+    return NULL;
+}
+
+bool FuncMemory::isWatched( uint64 tag) const
+{
+    const uint64* watched = ( const uint64*)this->watched_sets->find( tag >> this->page_bits);
+    uint64 page_num = tag & this->page_mask;
+    return watched != NULL && ( ( watched[ page_num / 64] >> ( page_num % 64)) & 1) != 0;
+}
+
+void FuncMemory::checkWatchpoints( uint64 addr, uint64 size, bool is_write) const
+{
+    // the callback could access the memory itself
+    if ( this->in_watch_callback)
+        return;
+
+    WatchKind kind = is_write ? WATCH_WRITE : WATCH_READ;
+
+    this->in_watch_callback = true;
+    for ( size_t i = 0; i < this->watchpoints.size(); ++i)
+    {
+        const Watchpoint& watchpoint = this->watchpoints[ i];
+        if ( ( watchpoint.kind & kind) != 0 &&
+             addr <= watchpoint.addr + ( watchpoint.size - 1) &&
+             watchpoint.addr <= addr + ( size - 1))
+        {
+            watchpoint.callback( addr, size, is_write, watchpoint.context);
+        }
+    }
+    this->in_watch_callback = false;
+}
+
+void FuncMemory::updateWatchedPages()
+{
+    // the watched pages could be cached
+    this->flushTlb();
+
+    // without watchpoints the accesses do not look into the bitmaps at all
+    if ( this->watchpoints.empty())
+    {
+        if ( this->watched_sets != NULL)
+        {
+            freeSetArrays( this->watched_sets);
+            delete this->watched_sets;
+            this->watched_sets = NULL;
+        }
+        return;
+    }
+
+    if ( this->watched_sets == NULL)
+        this->watched_sets = new RadixTree( this->set_bits);
+    else
+        freeSetArrays( this->watched_sets);
+
+    for ( size_t i = 0; i < this->watchpoints.size(); ++i)
+    {
+        const Watchpoint& watchpoint = this->watchpoints[ i];
+        uint64 last_tag = ( watchpoint.addr + watchpoint.size - 1) >> this->offset_bits;
+
+        for ( uint64 tag = watchpoint.addr >> this->offset_bits; tag <= last_tag; ++tag)
+        {
+            void** slot = this->watched_sets->slot( tag >> this->page_bits);
+            if ( *slot == NULL)
+            {
+                *slot = calloc( ( this->pages_num + 63) / 64, sizeof( uint64));
+                assert( *slot != NULL);
+            }
+
+            uint64* watched = ( uint64*)*slot;
+            uint64 page_num = tag & this->page_mask;
+            watched[ page_num / 64] |= ( uint64)1 << ( page_num % 64);
+        }
+    }
+}
+
+void FuncMemory::addWatchpoint( uint64 addr, uint64 size, WatchKind kind,
+                                WatchCallback callback, void* context)
+{
+    // the flat mapping has no TLB to catch the accesses
+    assert( this->flat_pages == NULL);
+    assert( size > 0 && this->isValidRange( addr, size));
+    assert( callback != NULL);
+
+    Watchpoint watchpoint = { addr, size, kind, callback, context };
+    this->watchpoints.push_back( watchpoint);
+    this->updateWatchedPages();
+}
+
+void FuncMemory::removeWatchpoint( uint64 addr, uint64 size)
+{
+    for ( size_t i = 0; i < this->watchpoints.size(); )
+    {
+        if ( this->watchpoints[ i].addr == addr && this->watchpoints[ i].size == size)
+            this->watchpoints.erase( this->watchpoints.begin() + i);
+        else
+            ++i;
+    }
+
+    this->updateWatchedPages();
+}
+
+void FuncMemory::flushTlb()
+{
+    for ( size_t i = 0; i < TLB_SIZE; ++i)
+    {
+        this->tlb[ i].tag = NO_VAL64;
+        this->tlb[ i].data = NULL;
+        this->tlb[ i].shadow = NULL;
+        this->tlb[ i].perms = 0;
+    }
+}
+
+uint32 FuncMemory::fetch( uint64 addr) const
+{
+    uint64 offset = this->getOffset( addr);
+    uint32 instr;
+
+    if ( offset + sizeof( uint32) > this->page_size || ( addr & ~this->addr_mask) != 0)
+    {
+        instr = ( uint32)this->readBytes( addr, sizeof( uint32), this->byte_order, PERM_EXEC);
+    } else
+    {
+        const uint64* shadow;
+        const uint8* page = this->translate( addr, sizeof( uint32), shadow, PERM_EXEC);
+
+        // fetching of not initialized or written data is prohibited
+        assert( page != NULL);
+        assert( !FUNC_MEMORY_INIT_CHECK || shadow == NULL ||
+                isInitialized( shadow, offset, sizeof( uint32)));
+
+        memcpy( &instr, page + offset, sizeof( uint32));
+        instr = this->byte_order == BIG_ENDIAN_ORDER
+                ? convertByteOrder<BIG_ENDIAN_ORDER>( instr)
+                : convertByteOrder<LITTLE_ENDIAN_ORDER>( instr);
+    }
+
+    this->countAccess( addr, HEAT_FETCH);
+    return instr;
+}
+
+void FuncMemory::setPermissions( uint64 addr, uint64 size, uint32 perms)
+{
+    assert( ( perms & ~PERM_ALL) == 0);
+    assert( size > 0 && this->isValidRange( addr, size));
+
+    uint64 first_tag = addr >> this->offset_bits;
+    uint64 last_tag = ( addr + size - 1) >> this->offset_bits;
+
+    for ( uint64 tag = first_tag; tag <= last_tag; ++tag)
+    {
+        Page* page = this->getPage( tag << this->offset_bits);
+        if ( page != NULL && page->perms == perms)
+            continue;
+
+        if ( page != NULL && this->isZeroPage( page))
+        {
+            // the zeros stay shared by the zero page of the permissions
+            Page* zero_page = this->zeroPage( perms);
+            ++zero_page->ref_count;
+
+            Page** pages = this->getOrAllocDir( tag << this->offset_bits);
+            this->releasePage( pages[ this->getPageNum( tag << this->offset_bits)]);
+            pages[ this->getPageNum( tag << this->offset_bits)] = zero_page;
+            this->setDirty( tag);
+        } else
+        {
+            // the page becomes private as the shared ones keep their permissions
+            this->getOrAllocPage( tag << this->offset_bits)->perms = perms;
+        }
+
+        // the cached translation could allow more than the new permissions
+        TlbEntry& entry = this->tlb[ tag & ( TLB_SIZE - 1)];
+        if ( entry.tag == tag)
+            entry.tag = NO_VAL64;
+    }
+}
+
+uint32 FuncMemory::permissions( uint64 addr) const
+{
+    const Page* page = this->getPage( addr & this->addr_mask);
+    return page == NULL ? ( uint32)PERM_ALL : page->perms;
+}
+
+void FuncMemory::accessFault( uint64 addr, Permission perm) const
+{
+    const char* access = perm == PERM_WRITE ? "write to"
+                         : perm == PERM_EXEC ? "fetch from"
+                         : "read from";
+
+    cerr << "ERROR: " << access << " address 0x" << hex << addr << dec
+         << " is not permitted by the page" << endl;
+    exit( EXIT_FAILURE);
+}
+
+FuncMemory::PageHeat* FuncMemory::allocHeat( uint64 set, bool concurrent) const
+{
+    PageHeat* heat = ( PageHeat*)calloc( this->pages_num, sizeof( PageHeat));
+    assert( heat != NULL);
+
+    if ( !concurrent)
+    {
+        *this->heat_sets->slot( set) = heat;
+        return heat;
+    }
+
+    void* installed = NULL;
+    if ( MultiThreaded::compareAndSwap( this->heat_sets->slotShared( set), installed, ( void*)heat))
+        return heat;
+
+    // another thread has installed its array
+    free( heat);
+    return ( PageHeat*)installed;
+}
+
+vector<FuncMemory::PageHeatRecord> FuncMemory::sortHeat() const
+{
+    vector<PageHeatRecord> records;
+    if ( this->heat_sets == NULL)
+        return records;
+
+    uint64 set = 0;
+    for ( const void* array = this->heat_sets->findNext( set); array != NULL;
+          array = this->heat_sets->findNext( ++set))
+    {
+        const PageHeat* heat = ( const PageHeat*)array;
+        for ( uint64 page_num = 0; page_num < this->pages_num; ++page_num)
+        {
+            PageHeatRecord record;
+            record.page_addr = ( set * this->pages_num + page_num) << this->offset_bits;
+            record.total = 0;
+            for ( int kind = 0; kind < HEAT_KINDS_NUM; ++kind)
+            {
+                record.counters[ kind] = heat[ page_num].counters[ kind];
+                record.total += heat[ page_num].counters[ kind];
+            }
+
+            if ( record.total != 0)
+                records.push_back( record);
+        }
+    }
+
+    sort( records.begin(), records.end());
+    return records;
+}
+
+void FuncMemory::dumpHeatMap( ostream& out) const
+{
+    vector<PageHeatRecord> records = this->sortHeat();
+
+    out << "page,reads,writes,fetches,total" << endl;
+    for ( size_t i = 0; i < records.size(); ++i)
+    {
+        out << "0x" << hex << records[ i].page_addr << dec << ","
+            << records[ i].counters[ HEAT_READ] << ","
+            << records[ i].counters[ HEAT_WRITE] << ","
+            << records[ i].counters[ HEAT_FETCH] << ","
+            << records[ i].total << endl;
+    }
+}
+
+void FuncMemory::dumpHotPages( ostream& out, size_t pages_num) const
+{
+    vector<PageHeatRecord> records = this->sortHeat();
+    uint64 total = 0;
+    for ( size_t i = 0; i < records.size(); ++i)
+        total += records[ i].total;
+
+    out << "Hottest pages of the functional memory, " << total << " accesses to "
+        << records.size() << " pages:" << endl;
+
+    for ( size_t i = 0; i < records.size() && i < pages_num; ++i)
+    {
+        out << "  0x" << hex << records[ i].page_addr << dec << ": "
+            << records[ i].total << " accesses ("
+            << ( 100 * records[ i].total / total) << "%), "
+            << records[ i].counters[ HEAT_READ] << " reads, "
+            << records[ i].counters[ HEAT_WRITE] << " writes, "
+            << records[ i].counters[ HEAT_FETCH] << " fetches" << endl;
+    }
+}
+
+void FuncMemory::clearHeatMap()
+{
+    if ( this->heat_sets != NULL)
+        freeSetArrays( this->heat_sets);
 }
 
 uint64 FuncMemory::startPC() const
 {
-    // put your code here
+    return this->start_pc;
 }
 
 uint64 FuncMemory::read( uint64 addr, unsigned short num_of_bytes) const
 {
-    // put your code here
-
-    return 0;
+    return this->byte_order == BIG_ENDIAN_ORDER
+           ? this->readAny<BIG_ENDIAN_ORDER>( addr, num_of_bytes)
+           : this->readAny<LITTLE_ENDIAN_ORDER>( addr, num_of_bytes);
 }
 
 void FuncMemory::write( uint64 value, uint64 addr, unsigned short num_of_bytes)
 {
-    // put your code here
+    if ( this->byte_order == BIG_ENDIAN_ORDER)
+        this->writeAny<BIG_ENDIAN_ORDER>( value, addr, num_of_bytes);
+    else
+        this->writeAny<LITTLE_ENDIAN_ORDER>( value, addr, num_of_bytes);
+}
+
+template<ByteOrder ORDER>
+uint64 FuncMemory::readAny( uint64 addr, unsigned short num_of_bytes) const
+{
+    switch ( num_of_bytes)
+    {
+        case sizeof( uint8):  return this->read<uint8, ORDER>( addr);
+        case sizeof( uint16): return this->read<uint16, ORDER>( addr);
+        case sizeof( uint32): return this->read<uint32, ORDER>( addr);
+        case sizeof( uint64): return this->read<uint64, ORDER>( addr);
+        default:
+            uint64 value = this->readBytes( addr, num_of_bytes, ORDER);
+            this->countAccess( addr, HEAT_READ);
+            return value;
+    }
+}
+
+template<ByteOrder ORDER>
+void FuncMemory::writeAny( uint64 value, uint64 addr, unsigned short num_of_bytes)
+{
+    switch ( num_of_bytes)
+    {
+        case sizeof( uint8):  this->write<uint8, ORDER>( ( uint8)value, addr); break;
+        case sizeof( uint16): this->write<uint16, ORDER>( ( uint16)value, addr); break;
+        case sizeof( uint32): this->write<uint32, ORDER>( ( uint32)value, addr); break;
+        case sizeof( uint64): this->write<uint64, ORDER>( value, addr); break;
+        default:
+            this->writeBytes( value, addr, num_of_bytes, ORDER);
+            this->countAccess( addr, HEAT_WRITE);
+            break;
+    }
+}
+
+// returns the position of the byte in a value of the given size
+static inline unsigned short byteShift( unsigned short byte_num,
+                                        unsigned short num_of_bytes,
+                                        ByteOrder order)
+{
+    return 8 * ( order == LITTLE_ENDIAN_ORDER ? byte_num : num_of_bytes - 1 - byte_num);
+}
+
+uint64 FuncMemory::readBytes( uint64 addr, unsigned short num_of_bytes, ByteOrder order,
+                              Permission perm) const
+{
+    assert( num_of_bytes > 0 && num_of_bytes <= sizeof( uint64));
+    assert( ( addr & ~this->addr_mask) == 0);
+
+    // in the little-endian order the byte having the lowest
+    // address is the least significant one, and vice versa
+    uint64 value = 0;
+    unsigned short done = 0;
+
+    // the access is translated once per each page it touches
+    while ( done < num_of_bytes)
+    {
+        uint64 chunk_addr = ( addr + done) & this->addr_mask;
+        uint64 offset = this->getOffset( chunk_addr);
+        uint64 chunk = min( ( uint64)( num_of_bytes - done), this->page_size - offset);
+
+        const uint64* shadow;
+        const uint8* page = this->translate( chunk_addr, chunk, shadow, perm);
+
+        // reading of not initialized or written data is prohibited
+        assert( page != NULL);
+        assert( !FUNC_MEMORY_INIT_CHECK || shadow == NULL ||
+                isInitialized( shadow, offset, chunk));
+
+        for ( ; done < num_of_bytes && offset < this->page_size; ++done, ++offset)
+            value |= ( uint64)page[ offset] << byteShift( done, num_of_bytes, order);
+    }
+
+    return value;
+}
+
+void FuncMemory::writeBytes( uint64 value, uint64 addr, unsigned short num_of_bytes, ByteOrder order)
+{
+    assert( num_of_bytes > 0 && num_of_bytes <= sizeof( uint64));
+    assert( ( addr & ~this->addr_mask) == 0);
+
+    unsigned short done = 0;
+    while ( done < num_of_bytes)
+    {
+        uint64 chunk_addr = ( addr + done) & this->addr_mask;
+        uint64 offset = this->getOffset( chunk_addr);
+        uint64 chunk = min( ( uint64)( num_of_bytes - done), this->page_size - offset);
+
+        uint64* shadow;
+        uint8* page = this->translateForWrite( chunk_addr, chunk, shadow);
+
+        if ( FUNC_MEMORY_INIT_CHECK && shadow != NULL)
+            setInitialized( shadow, offset, chunk);
+
+        for ( ; done < num_of_bytes && offset < this->page_size; ++done, ++offset)
+            page[ offset] = ( uint8)( value >> byteShift( done, num_of_bytes, order));
+    }
+}
+
+uint64 FuncMemory::readBytesShared( uint64 addr, unsigned short num_of_bytes, ByteOrder order) const
+{
+    assert( num_of_bytes > 0 && num_of_bytes <= sizeof( uint64));
+    assert( ( addr & ~this->addr_mask) == 0);
+
+    // an unaligned access is not atomic, so it is just done by bytes
+    uint64 value = 0;
+    for ( unsigned short i = 0; i < num_of_bytes; ++i)
+    {
+        uint64 byte = this->readUncounted<uint8, LITTLE_ENDIAN_ORDER, MultiThreaded>( ( addr + i) & this->addr_mask);
+        value |= byte << byteShift( i, num_of_bytes, order);
+    }
+
+    return value;
+}
+
+void FuncMemory::writeBytesShared( uint64 value, uint64 addr, unsigned short num_of_bytes, ByteOrder order)
+{
+    assert( num_of_bytes > 0 && num_of_bytes <= sizeof( uint64));
+    assert( ( addr & ~this->addr_mask) == 0);
+
+    for ( unsigned short i = 0; i < num_of_bytes; ++i)
+    {
+        uint8 byte = ( uint8)( value >> byteShift( i, num_of_bytes, order));
+        this->writeUncounted<uint8, LITTLE_ENDIAN_ORDER, MultiThreaded>( byte, ( addr + i) & this->addr_mask);
+    }
+}
+
+bool FuncMemory::isValidRange( uint64 addr, uint64 size) const
+{
+    return ( addr & ~this->addr_mask) == 0 &&
+           ( size == 0 || size - 1 <= this->addr_mask - addr);
+}
+
+void FuncMemory::readBlock( uint64 addr, uint8* dst, uint64 size) const
+{
+    assert( this->isValidRange( addr, size));
+
+    while ( size > 0)
+    {
+        uint64 offset = this->getOffset( addr);
+        uint64 chunk = min( size, this->page_size - offset);
+
+        const uint64* shadow;
+        const uint8* page = this->translate( addr, chunk, shadow);
+
+        // reading of not initialized or written data is prohibited
+        assert( page != NULL);
+        assert( !FUNC_MEMORY_INIT_CHECK || shadow == NULL ||
+                isInitialized( shadow, offset, chunk));
+
+        memcpy( dst, page + offset, chunk);
+        this->countAccess( addr, HEAT_READ);
+
+        dst += chunk;
+        addr += chunk;
+        size -= chunk;
+    }
+}
+
+void FuncMemory::writeBlock( const uint8* src, uint64 addr, uint64 size)
+{
+    assert( this->isValidRange( addr, size));
+
+    while ( size > 0)
+    {
+        uint64 offset = this->getOffset( addr);
+        uint64 chunk = min( size, this->page_size - offset);
+
+        // whole zero pages (e.g. of .bss) share the zero page
+        if ( chunk == this->page_size && isZeroBlock( src, chunk))
+        {
+            this->mapZeroPage( addr);
+        } else
+        {
+            uint64* shadow;
+            memcpy( this->translateForWrite( addr, chunk, shadow) + offset, src, chunk);
+            this->markInitialized( shadow, addr, chunk);
+        }
+        this->countAccess( addr, HEAT_WRITE);
+
+        src += chunk;
+        addr += chunk;
+        size -= chunk;
+    }
+}
+
+void FuncMemory::fill( uint8 value, uint64 addr, uint64 size)
+{
+    assert( this->isValidRange( addr, size));
+
+    while ( size > 0)
+    {
+        uint64 offset = this->getOffset( addr);
+        uint64 chunk = min( size, this->page_size - offset);
+
+        if ( chunk == this->page_size && value == 0)
+        {
+            this->mapZeroPage( addr);
+        } else
+        {
+            uint64* shadow;
+            memset( this->translateForWrite( addr, chunk, shadow) + offset, value, chunk);
+            this->markInitialized( shadow, addr, chunk);
+        }
+        this->countAccess( addr, HEAT_WRITE);
+
+        addr += chunk;
+        size -= chunk;
+    }
+}
+
+void FuncMemory::copyWithin( uint64 dst_addr, uint64 src_addr, uint64 size)
+{
+    assert( this->isValidRange( dst_addr, size));
+    assert( this->isValidRange( src_addr, size));
+
+    // As for memmove, the copying goes backward if the destination
+    // overlaps the tail of the source. A chunk is limited by the page
+    // boundaries of both the source and the destination.
+    bool backward = dst_addr > src_addr && dst_addr - src_addr < size;
+
+    while ( size > 0)
+    {
+        uint64 chunk;
+        uint64 src_chunk_addr;
+        uint64 dst_chunk_addr;
+
+        if ( backward)
+        {
+            chunk = min( size, min( this->getOffset( src_addr + size - 1),
+                                    this->getOffset( dst_addr + size - 1)) + 1);
+            src_chunk_addr = src_addr + size - chunk;
+            dst_chunk_addr = dst_addr + size - chunk;
+        }
+        else
+        {
+            chunk = min( size, this->page_size - max( this->getOffset( src_addr),
+                                                      this->getOffset( dst_addr)));
+            src_chunk_addr = src_addr;
+            dst_chunk_addr = dst_addr;
+            src_addr += chunk;
+            dst_addr += chunk;
+        }
+
+        const uint64* src_shadow;
+        const uint8* src_page = this->translate( src_chunk_addr, chunk, src_shadow);
+
+        // reading of not initialized or written data is prohibited
+        assert( src_page != NULL);
+        assert( !FUNC_MEMORY_INIT_CHECK || src_shadow == NULL ||
+                isInitialized( src_shadow, this->getOffset( src_chunk_addr), chunk));
+
+        uint64* dst_shadow;
+        uint8* dst_page = this->translateForWrite( dst_chunk_addr, chunk, dst_shadow);
+
+        // the chunks can overlap if both are inside the same page
+        memmove( dst_page + this->getOffset( dst_chunk_addr),
+                 src_page + this->getOffset( src_chunk_addr), chunk);
+        this->markInitialized( dst_shadow, dst_chunk_addr, chunk);
+
+        this->countAccess( src_chunk_addr, HEAT_READ);
+        this->countAccess( dst_chunk_addr, HEAT_WRITE);
+
+        size -= chunk;
+    }
+}
+
+// prints the value in hex without leading zeros, returns the end of the printed text
+static char* printHex( char* pos, uint64 value)
+{
+    static const char digits[] = "0123456789abcdef";
+
+    char buffer[ 2 * sizeof( uint64)];
+    char* end = buffer + sizeof( buffer);
+    char* begin = end;
+    do
+    {
+        *--begin = digits[ value & 0xf];
+        value >>= 4;
+    } while ( value != 0);
+
+    memcpy( pos, begin, end - begin);
+    return pos + ( end - begin);
 }
 
 string FuncMemory::dump( string indent) const
 {
-    // put your code here
-    return string("ERROR: You need to implement FuncMemory!");
+    ostringstream oss;
+    this->dump( oss, indent);
+    return oss.str();
+}
+
+void FuncMemory::dump( ostream& out, string indent, uint64 begin, uint64 end) const
+{
+    out << indent << "Dump of the functional memory" << endl
+        << indent << "  addr_size = " << this->addr_size << " bits" << endl
+        << indent << "  page_num_size = " << this->page_bits << " bits" << endl
+        << indent << "  offset_size = " << this->offset_bits << " bits" << endl
+        << indent << "  Content:" << endl;
+
+    string skip_line = indent + "  ....  \n";
+    string line_prefix = indent + "    0x";
+
+    // a line is formatted in place, the text of a page is written at once
+    vector<char> line( line_prefix.size() + 2 * sizeof( uint64) + 5 + 2 * sizeof( uint32) + 1);
+    memcpy( &line[ 0], line_prefix.data(), line_prefix.size());
+    string text;
+
+    // print the allocated pages by words of 4 bytes skipping zero ones
+    bool skip_was_printed = false;
+    uint64 tag = begin >> this->offset_bits;
+    for ( const Page* page = this->findPage( tag); page != NULL;
+          page = this->findPage( ++tag))
+    {
+        uint64 page_addr = tag << this->offset_bits;
+        if ( page_addr >= end)
+            break;
+
+        const uint8* data = page->data;
+        text.clear();
+
+        // the words outside the range are not printed at all
+        uint64 offset = begin > page_addr ? ( begin - page_addr) & ~( uint64)( sizeof( uint32) - 1) : 0;
+        uint64 end_offset = end - page_addr < this->page_size ? end - page_addr : this->page_size;
+
+        while ( offset < end_offset)
+        {
+            // zero runs are skipped by 8 bytes, the zero page is not read at all
+            uint64 zero_bytes = 0;
+            if ( this->isZeroPage( page))
+            {
+                zero_bytes = end_offset - offset;
+            } else
+            {
+                while ( offset + zero_bytes + sizeof( uint64) <= end_offset &&
+                        SingleThreaded::load( ( const uint64*)( data + offset + zero_bytes)) == 0)
+                {
+                    zero_bytes += sizeof( uint64);
+                }
+            }
+
+            uint64 num_of_bytes = min( ( uint64)sizeof( uint32), end_offset - offset);
+            if ( zero_bytes == 0 && isZeroBlock( data + offset, num_of_bytes))
+                zero_bytes = num_of_bytes;
+
+            if ( zero_bytes != 0)
+            {
+                if ( !skip_was_printed)
+                {
+                    text += skip_line;
+                    skip_was_printed = true;
+                }
+                offset += zero_bytes;
+                continue;
+            }
+
+            // "<indent>    0x<addr>:    <bytes>"
+            char* pos = printHex( &line[ line_prefix.size()], page_addr + offset);
+            memcpy( pos, ":    ", 5);
+            pos += 5;
+            for ( uint64 i = 0; i < num_of_bytes; ++i)
+            {
+                // two hex symbols per byte, e.g. "08"
+                *pos++ = "0123456789abcdef"[ data[ offset + i] >> 4];
+                *pos++ = "0123456789abcdef"[ data[ offset + i] & 0xf];
+            }
+            *pos++ = '\n';
+            text.append( &line[ 0], pos - &line[ 0]);
+
+            skip_was_printed = false;
+            offset += num_of_bytes;
+        }
+
+        out.write( text.data(), text.size());
+    }
+
+    out.flush();
 }
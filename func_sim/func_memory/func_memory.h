@@ -1,5 +1,5 @@
 /**
- * func_memory.h - Header of module implementing the concept of 
+ * func_memory.h - Header of module implementing the concept of
  * programer-visible memory space accesing via memory address.
  * @author Alexander Titov <alexander.igorevich.titov@gmail.com>
  * Copyright 2012 uArchSim iLab project
@@ -9,37 +9,880 @@
 #ifndef FUNC_MEMORY__FUNC_MEMORY_H
 #define FUNC_MEMORY__FUNC_MEMORY_H
 
+// Generic C
+#include <cstring>
+#include <stdint.h>
+
 // Generic C++
 #include <string>
+#include <ostream>
+#include <vector>
 #include <cassert>
 
 // uArchSim modules
 #include <types.h>
 #include <elf_parser.h>
+#include <page_arena.h>
+#include <radix_tree.h>
 
 using namespace std;
 
+enum ByteOrder
+{
+    LITTLE_ENDIAN_ORDER,
+    BIG_ENDIAN_ORDER
+};
+
+#if defined( __BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+static const ByteOrder HOST_BYTE_ORDER = BIG_ENDIAN_ORDER;
+#else
+static const ByteOrder HOST_BYTE_ORDER = LITTLE_ENDIAN_ORDER;
+#endif
+
+// reverse the order of bytes in a value, the switch is resolved at compile time
+template<typename T>
+inline T swapBytes( T value)
+{
+    switch ( sizeof( T))
+    {
+        case sizeof( uint16): return ( T)__builtin_bswap16( ( uint16)value);
+        case sizeof( uint32): return ( T)__builtin_bswap32( ( uint32)value);
+        case sizeof( uint64): return ( T)__builtin_bswap64( ( uint64)value);
+        default:              return value;
+    }
+}
+
+// Converts a value between the given byte order and the host one.
+// The order is known at compile time, so the function is either
+// an identity or a single byte swap.
+template<ByteOrder ORDER, typename T>
+inline T convertByteOrder( T value)
+{
+    return ORDER == HOST_BYTE_ORDER ? value : swapBytes( value);
+}
+
+// Policies of the accesses to the memory shared by several threads.
+// With SingleThreaded the accesses are plain loads and stores. With
+// MultiThreaded the aligned accesses up to 8 bytes are atomic, and
+// the pointers are published with the release-acquire ordering.
+struct SingleThreaded
+{
+    static const bool CONCURRENT = false;
+
+    template<typename T> static T load( const T* ptr)
+    {
+        T value;
+        memcpy( &value, ptr, sizeof( T));
+        return value;
+    }
+
+    template<typename T> static void store( T* ptr, T value)
+    {
+        memcpy( ptr, &value, sizeof( T));
+    }
+
+    static void setBits( uint64* word, uint64 mask) { *word |= mask; }
+
+    static void add( uint64* counter, uint64 value) { *counter += value; }
+};
+
+struct MultiThreaded
+{
+    static const bool CONCURRENT = true;
+
+    template<typename T> static T load( const T* ptr)
+    {
+        if ( ( uintptr_t)ptr % sizeof( T) != 0)
+            return SingleThreaded::load( ptr);
+
+        return __atomic_load_n( ptr, __ATOMIC_ACQUIRE);
+    }
+
+    template<typename T> static void store( T* ptr, T value)
+    {
+        if ( ( uintptr_t)ptr % sizeof( T) != 0)
+            SingleThreaded::store( ptr, value);
+        else
+            __atomic_store_n( ptr, value, __ATOMIC_RELEASE);
+    }
+
+    static void setBits( uint64* word, uint64 mask)
+    {
+        __atomic_fetch_or( word, mask, __ATOMIC_RELAXED);
+    }
+
+    static void add( uint64* counter, uint64 value)
+    {
+        __atomic_fetch_add( counter, value, __ATOMIC_RELAXED);
+    }
+
+    // on failure the expected value is updated by the current one
+    template<typename T> static bool compareAndSwap( T* ptr, T& expected, T desired)
+    {
+        return __atomic_compare_exchange_n( ptr, &expected, desired, false,
+                                            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+    }
+
+    // returns the previous value
+    template<typename T> static T fetchAdd( T* ptr, T value)
+    {
+        return __atomic_fetch_add( ptr, value, __ATOMIC_ACQ_REL);
+    }
+};
+
+// Define FUNC_MEMORY_NO_INIT_CHECK to build the memory for trusted
+// runs: the bitmaps of initialized bytes are neither kept nor checked.
+#ifdef FUNC_MEMORY_NO_INIT_CHECK
+static const bool FUNC_MEMORY_INIT_CHECK = false;
+#else
+static const bool FUNC_MEMORY_INIT_CHECK = true;
+#endif
+
+// Define FUNC_MEMORY_HEAT_MAP to count the accesses to each page,
+// otherwise the counting is compiled out.
+#ifdef FUNC_MEMORY_HEAT_MAP
+static const bool FUNC_MEMORY_HEAT_COUNT = true;
+#else
+static const bool FUNC_MEMORY_HEAT_COUNT = false;
+#endif
+
+//
+// The memory is organized as a radix tree:
+//
+//   | set number | page number |     offset     |
+//    <-set_bits-> <-page_bits-> <-offset_bits->
+//
+// The set table is a RadixTree itself. For the usual 32-bit spaces it is
+// a single table allocated at once, for 64-bit ones the set number is
+// split into several levels and the paths through the sparse upper bits
+// are compressed, so a lookup takes a few dependent loads. Page
+// directories and pages are allocated only when they are written for
+// the first time. Thus, the consumed host memory is proportional to
+// the number of touched pages rather than to the size of the address space.
+//
+// For addresses up to 32 bits the whole guest space can be reserved
+// instead as a single host mapping (FLAT_MAPPING backend). Then a page
+// is just a slot of the mapping and translation needs a single lookup
+// to check that the page was written, which is preserved to catch
+// reads of not initialized memory.
+//
+// Each page has a shadow bitmap with a bit per byte that was written,
+// a read of a byte never written aborts. The bitmap is tested by whole
+// words, so an access inside a page costs a single mask test. Pages
+// written entirely have no bitmap at all, which is the common case.
+//
+// Each page has the permissions to read, write and execute it. They
+// are copied into the TLB entry, so an access is checked by the same
+// lookup that translates it, and the pages lacking a permission miss.
+//
+// Pages of the PAGE_TABLE backend are reference counted, so a snapshot
+// of the memory just copies the page table and shares all the pages
+// with it. A shared page is copied on the first write to it.
+//
+// The typed accesses with the MultiThreaded policy can be done by several
+// threads at once. They bypass the TLB and install new pages and private
+// copies of shared ones with compare-and-swap, the thread losing the race
+// frees its page. The bitmaps are never dropped by such accesses as
+// other threads could use them. All the other methods need exclusive
+// access to the memory.
+//
 class FuncMemory
 {
+public:
+    enum Backend
+    {
+        PAGE_TABLE,
+        FLAT_MAPPING
+    };
+
+    // kinds of the accesses caught by a watchpoint
+    enum WatchKind
+    {
+        WATCH_READ = 0x1,
+        WATCH_WRITE = 0x2,
+        WATCH_ACCESS = WATCH_READ | WATCH_WRITE
+    };
+
+    // is called before the access overlapping the watched range
+    typedef void ( *WatchCallback)( uint64 addr, uint64 size, bool is_write, void* context);
+
+    // permissions of the accesses to a page
+    enum Permission
+    {
+        PERM_READ = 0x1,
+        PERM_WRITE = 0x2,
+        PERM_EXEC = 0x4,
+        PERM_ALL = PERM_READ | PERM_WRITE | PERM_EXEC
+    };
+
+private:
     // You could not create the object
     // using this default constructor
     FuncMemory(){}
 
+    uint64 addr_size;   // size of the address in bits
+    uint64 set_bits;    // number of bits in the set number
+    uint64 page_bits;   // number of bits in the page number
+    uint64 offset_bits; // number of bits in the offset inside a page
+
+    uint64 addr_mask;   // bits that are allowed to be set in an address
+    uint64 page_mask;   // applied to ( addr >> offset_bits)
+    uint64 offset_mask; // applied to addr
+
+    uint64 pages_num; // number of entries in a page directory
+    uint64 page_size; // size of a page in bytes
+    uint64 tags_num;  // number of pages in the address space
+
+    struct Page
+    {
+        uint8* data;      // NULL if the page of the flat mapping is not written
+        uint32 ref_count; // number of page tables referring to the page
+        uint32 perms;     // permissions of the accesses to the page
+        uint64* shadow;   // bitmap of written bytes, NULL if all of them are
+    };
+
+    RadixTree* sets; // set table: set -> page directory -> page
+
+    PageArena* page_arena;      // storage of the page data
+    PageArena* page_info_arena; // storage of the Page structures
+    PageArena* shadow_arena;    // storage of the shadow bitmaps
+
+    // The image file mapped privately, pages and bitmaps loaded
+    // from it point into the mapping instead of the arenas.
+    uint8* image_base;
+    uint64 image_size;
+
+    bool isImageMemory( const void* ptr) const;
+    void releaseShadow( uint64* shadow);
+
+    // The pages of the PAGE_TABLE backend shared by all the zero-filled
+    // pages, one per permissions so the protected zeros stay shared.
+    // They are copied on the first write like the pages shared with
+    // a snapshot, the ones of restricted permissions are made on demand.
+    Page* zero_pages[ PERM_ALL + 1];
+
+    // returns the zero page having the permissions
+    Page* zeroPage( uint32 perms);
+    bool isZeroPage( const Page* page) const;
+
+    // maps the whole page containing the address to the zero page
+    void mapZeroPage( uint64 addr);
+
+    // reports the access violating the permissions of the page and exits
+    void accessFault( uint64 addr, Permission perm) const;
+
+    // Checks that the bits [offset, offset + size) of the bitmap are set
+    // or sets them. The bits are processed by whole words, so a range
+    // inside a word takes a single mask operation.
+    template<typename Sync = SingleThreaded>
+    static inline bool isInitialized( const uint64* shadow, uint64 offset, uint64 size);
+    template<typename Sync = SingleThreaded>
+    static inline void setInitialized( uint64* shadow, uint64 offset, uint64 size);
+
+    // Returns a bitmap filled by zeros or a copy of the given one,
+    // NULL if the bitmaps are not kept.
+    uint64* allocShadow( const uint64* content = NULL);
+    // Marks the range of the page as written, the bitmap is dropped
+    // if the range is the whole page. The page must be private.
+    void markInitialized( uint64* shadow, uint64 addr, uint64 size);
+
+    uint8* flat_base;  // the host mapping of the FLAT_MAPPING backend
+    PageArena::HugePages flat_huge_pages; // the backing of the mapping
+    Page*  flat_pages; // pages of the flat mapping indexed by the tag
+
+    // Bitmaps of pages written since the last checkpoint, one per set.
+    // Writes cached in the TLB do not set the bits, so the TLB
+    // is flushed once the bitmaps are cleared. The flat mapping has
+    // no TLB and checks the bit on each write, so it keeps a single
+    // bitmap indexed by the tag instead of the sets.
+    RadixTree* dirty_sets; // NULL for the flat mapping
+    uint64*  flat_dirty;   // NULL for the page table
+    uint64   dirty_words_num; // size of a bitmap in words
+    bool     checkpoint_full; // the next checkpoint must save all the pages
+
+    bool isDirty( uint64 tag) const;
+    void setDirty( uint64 tag);
+    void clearDirty();
+
+    struct Watchpoint
+    {
+        uint64 addr;
+        uint64 size;
+        WatchKind kind;
+        WatchCallback callback;
+        void* context;
+    };
+    vector<Watchpoint> watchpoints;
+
+    // Bitmaps of pages having watchpoints, one per set, NULL if there are
+    // no watchpoints at all. Such pages are never cached in the TLB,
+    // so only the accesses missing the TLB look into the bitmaps.
+    RadixTree* watched_sets;
+    mutable bool in_watch_callback; // the accesses of a callback are not checked
+
+    bool isWatched( uint64 tag) const;
+    // calls the callbacks of the watchpoints overlapping the access
+    void checkWatchpoints( uint64 addr, uint64 size, bool is_write) const;
+    void updateWatchedPages();
+
+    // Access counters of the pages, an array per set like the page
+    // directories, allocated on the first access to the set.
+    enum HeatKind
+    {
+        HEAT_READ,
+        HEAT_WRITE,
+        HEAT_FETCH,
+        HEAT_KINDS_NUM
+    };
+    struct PageHeat
+    {
+        uint64 counters[ HEAT_KINDS_NUM];
+    };
+    RadixTree* heat_sets; // NULL if the counting is compiled out
+
+    PageHeat* allocHeat( uint64 set, bool concurrent) const;
+
+    // the counters of a page for sorting them
+    struct PageHeatRecord
+    {
+        uint64 page_addr;
+        uint64 counters[ HEAT_KINDS_NUM];
+        uint64 total;
+
+        // the hottest pages go first, the pages of equal heat by the address
+        bool operator<( const PageHeatRecord& that) const
+        {
+            return this->total != that.total ? this->total > that.total
+                                             : this->page_addr < that.page_addr;
+        }
+    };
+    // the accessed pages, the hottest ones first
+    vector<PageHeatRecord> sortHeat() const;
+    template<typename Sync = SingleThreaded>
+    inline void countAccess( uint64 addr, HeatKind kind) const;
+
+    uint64 start_pc; // the start address of the ".text" section
+
+    ByteOrder byte_order; // the byte order of the guest taken from the ELF
+
+    // Direct-mapped cache of recent translations of the page tag
+    // ( addr >> offset_bits) into the host page, i.e. a software TLB.
+    // It is mutable as read() fills it, although it is const.
+    struct TlbEntry
+    {
+        uint64 tag;    // NO_VAL64 if the entry is not valid
+        uint8* data;
+        uint64* shadow;
+        uint32 perms; // PERM_WRITE is dropped if the page is shared with a snapshot
+    };
+    static const size_t TLB_SIZE = 64; // must be a power of 2
+    mutable TlbEntry tlb[ TLB_SIZE];
+    mutable uint64 tlb_hits;
+    mutable uint64 tlb_misses;
+
+    uint64 getSetNum( uint64 addr) const { return addr >> ( offset_bits + page_bits); }
+    uint64 getPageNum( uint64 addr) const { return ( addr >> offset_bits) & page_mask; }
+    uint64 getOffset( uint64 addr) const { return addr & offset_mask; }
+
+    // returns the page containing the address or NULL if it was not allocated
+    Page* getPage( uint64 addr) const;
+    // returns the page directory of the set containing the address,
+    // allocates it if needed
+    Page** getOrAllocDir( uint64 addr);
+    // Returns the page containing the address ready to be written,
+    // i.e. allocates it if needed and makes a private copy if it is shared.
+    Page* getOrAllocPage( uint64 addr);
+
+    // Looks for the first allocated page having the tag
+    // ( addr >> offset_bits) not less than the given one.
+    // Returns NULL if there is no such page, otherwise the tag
+    // is set to the one of the found page.
+    const Page* findPage( uint64& tag) const;
+
+    // Returns a copy of the page or a zero-filled one without a bitmap,
+    // a copy of a zero page takes its permissions without reading it.
+    Page* allocPage( const Page* original = NULL);
+    void  releasePage( Page* page);
+
+    // returns the page to the arenas
+    void freePage( Page* page);
+
+    // The counterparts of the functions above for the concurrent accesses.
+    // The arenas are not thread-safe, so they are guarded by a spin lock.
+    bool arenas_locked;
+    void lockArenas();
+    void unlockArenas();
+    Page* getPageShared( uint64 addr) const;
+    Page* getOrAllocPageShared( uint64 addr);
+    void  releasePageShared( Page* page);
+    void  setDirtyShared( uint64 tag);
+    inline uint8* translateShared( uint64 addr, const uint64*& shadow) const;
+    inline uint8* translateForWriteShared( uint64 addr, uint64*& shadow);
+    uint64 readBytesShared( uint64 addr, unsigned short num_of_bytes, ByteOrder order) const;
+    void   writeBytesShared( uint64 value, uint64 addr, unsigned short num_of_bytes, ByteOrder order);
+
+    // copy the page table sharing the pages and release such a copy
+    RadixTree* copySets( const RadixTree* sets);
+    void       releaseSets( RadixTree* sets);
+
+    // Return the page data as the functions above, but look into the TLB
+    // first. The shadow bitmap of the page is returned as well. The size
+    // of the access is needed to check the watchpoints on a TLB miss.
+    // The permissions are checked by the same lookup, the pages lacking
+    // the permission are never taken from the TLB.
+    inline uint8* translate( uint64 addr, uint64 size, const uint64*& shadow,
+                             Permission perm = PERM_READ) const;
+    inline uint8* translateForWrite( uint64 addr, uint64 size, uint64*& shadow);
+
+    // common part of the constructors
+    void init( uint64 addr_size, uint64 page_bits,
+               uint64 offset_bits, Backend backend, bool use_huge_pages);
+    // releases all the pages
+    void clear();
+    // replays the checkpoint already read into the buffer
+    void replayCheckpoint( const vector<uint8>& buffer, const char* file_name);
+
+    // generic accesses of any width, that can cross page boundaries
+    uint64 readBytes( uint64 addr, unsigned short num_of_bytes, ByteOrder order,
+                      Permission perm = PERM_READ) const;
+    void   writeBytes( uint64 value, uint64 addr, unsigned short num_of_bytes, ByteOrder order);
+
+    // the typed accesses without counting them in the heat map
+    template<typename T, ByteOrder ORDER, typename Sync>
+    T    readUncounted( uint64 addr) const;
+    template<typename T, ByteOrder ORDER, typename Sync>
+    void writeUncounted( T value, uint64 addr);
+
+    // runtime-width accesses in the given byte order
+    template<ByteOrder ORDER> uint64 readAny( uint64 addr, unsigned short num_of_bytes) const;
+    template<ByteOrder ORDER> void   writeAny( uint64 value, uint64 addr, unsigned short num_of_bytes);
+
+    // checks that [addr, addr + size) lies inside the address space
+    bool isValidRange( uint64 addr, uint64 size) const;
+
 public:
 
+    // Loads the sections of the ELF file. With protect_sections the pages
+    // of the sections can be accessed only as their flags permit, e.g.
+    // a write to ".text" or a fetch from ".data" is an error.
+    // With load_segments the PT_LOAD segments are loaded instead, as
+    // the OS does it, and the execution starts from the entry point.
+    // The zeroed tails of sections and segments (e.g. ".bss") are not
+    // read: their whole pages share the zero page until written.
     FuncMemory ( const char* executable_file_name,
                  uint64 addr_size = 32,
                  uint64 page_num_size = 10,
-                 uint64 offset_size = 12);
-    
+                 uint64 offset_size = 12,
+                 Backend backend = PAGE_TABLE,
+                 bool use_huge_pages = false,
+                 bool protect_sections = false,
+                 bool load_segments = false);
+
+    // Creates the memory from a chain of checkpoints,
+    // the first of them must contain the whole memory.
+    FuncMemory( const vector<string>& checkpoint_files,
+                Backend backend = PAGE_TABLE,
+                bool use_huge_pages = false);
+
+    // selects the constructor opening an image, e.g. FuncMemory mem( FuncMemory::IMAGE, "a.img")
+    enum ImageTag { IMAGE };
+
+    // Opens the image saved by saveImage(). The file is mapped privately,
+    // so the pages are read from the disk only when they are touched
+    // and the writes never reach the file.
+    FuncMemory( ImageTag,
+                const char* image_file_name,
+                Backend backend = PAGE_TABLE,
+                bool use_huge_pages = false);
+
     virtual ~FuncMemory();
-    
+
+    // accesses in the byte order of the guest
     uint64 read( uint64 addr, unsigned short num_of_bytes = 4) const;
     void   write( uint64 value, uint64 addr, unsigned short num_of_bytes = 4);
-    
+
+    // Accesses of the width known at compile time, T is one of
+    // uint8, uint16, uint32 and uint64. An access inside a page
+    // is a single host load or store followed by a byte swap if
+    // the given byte order differs from the host one. The accesses
+    // with the MultiThreaded policy can be done by several threads.
+    template<typename T, ByteOrder ORDER, typename Sync = SingleThreaded>
+    T    read( uint64 addr) const;
+    template<typename T, ByteOrder ORDER, typename Sync = SingleThreaded>
+    void write( T value, uint64 addr);
+
+    // the same in the byte order of the guest chosen at runtime
+    template<typename T> T    read( uint64 addr) const;
+    template<typename T> void write( T value, uint64 addr);
+
+    ByteOrder byteOrder() const { return this->byte_order; }
+
+    // Reads an instruction, unlike read() the page must be executable.
+    // The fetches are counted separately in the heat map.
+    uint32 fetch( uint64 addr) const;
+
+    // Sets the permissions of all the pages overlapping the range.
+    // An access violating them prints an error and exits. The pages
+    // of an ELF file loaded with protect_sections take the permissions
+    // of their sections, all the other pages are created with PERM_ALL.
+    void setPermissions( uint64 addr, uint64 size, uint32 perms);
+    // returns the permissions of the page, PERM_ALL if it is not allocated
+    uint32 permissions( uint64 addr) const;
+
+    // Block accesses of arbitrary size. The range is split into
+    // per-page chunks, each of them is copied by a single memcpy/memset.
+    // Zero-filled whole pages are mapped to the shared zero page.
+    void readBlock( uint64 addr, uint8* dst, uint64 size) const;
+    void writeBlock( const uint8* src, uint64 addr, uint64 size);
+    void fill( uint8 value, uint64 addr, uint64 size);
+    // works as memmove, i.e. the ranges are allowed to overlap
+    void copyWithin( uint64 dst_addr, uint64 src_addr, uint64 size);
+
     uint64 startPC() const;
-    
+
+    // statistics of the translation cache
+    uint64 tlbHits() const { return this->tlb_hits; }
+    uint64 tlbMisses() const { return this->tlb_misses; }
+
+    // The concurrent accesses do not update the translation cache,
+    // so it must be flushed before the single-threaded ones.
+    void flushTlb();
+
+    // the maximal number of bytes taken from the host for the pages
+    uint64 arenaPeakFootprint() const;
+    // what kind of huge pages were actually obtained to back the pages
+    PageArena::HugePages hugePages() const;
+
     string dump( string indent = "") const;
+
+    // Streams the same dump page by page, the words are printed only
+    // if their addresses are in [begin, end). Zero pages and runs of
+    // zero words are printed as a single "...." line.
+    void dump( ostream& out, string indent = "",
+               uint64 begin = 0, uint64 end = MAX_VAL64) const;
+
+    // Saves the pages written since the previous checkpoint into the file,
+    // the first checkpoint (or the one after restore()) saves all the pages.
+    void saveCheckpoint( const char* file_name);
+    // replays the checkpoint saved by a memory of the same configuration
+    void loadCheckpoint( const char* file_name);
+    // number of pages to be saved by the next checkpoint
+    uint64 dirtyPagesNum() const;
+
+    // saves all the pages into the file to be opened as an image
+    void saveImage( const char* file_name) const;
+
+    // Write the access counters of the pages defined FUNC_MEMORY_HEAT_MAP:
+    // all the accessed pages as CSV sorted by the number of accesses
+    // or a summary of the given number of the hottest ones.
+    void dumpHeatMap( ostream& out) const;
+    void dumpHotPages( ostream& out, size_t pages_num = 10) const;
+    // resets the counters, e.g. the constructors do it after loading
+    void clearHeatMap();
+
+    // The saved memory state. Its pages are shared with the memory
+    // until they are written. A snapshot can be taken only from
+    // the PAGE_TABLE backend and must be deleted before the memory.
+    class Snapshot
+    {
+        friend class FuncMemory;
+
+        FuncMemory* memory;
+        RadixTree* sets;
+
+        Snapshot( FuncMemory* memory, RadixTree* sets)
+            : memory( memory), sets( sets)
+        { }
+        Snapshot( const Snapshot&);
+        Snapshot& operator=( const Snapshot&);
+
+    public:
+        virtual ~Snapshot();
+    };
+
+    // Calls the callback on each access of the kind overlapping the range
+    // [addr, addr + size). The watchpoints are supported by the PAGE_TABLE
+    // backend only and are not checked by the concurrent accesses.
+    void addWatchpoint( uint64 addr, uint64 size, WatchKind kind,
+                        WatchCallback callback, void* context = NULL);
+    // removes the watchpoints of exactly the given range
+    void removeWatchpoint( uint64 addr, uint64 size);
+
+    // takes a snapshot in O( number of page table entries), use delete to free it
+    Snapshot* snapshot();
+    // returns the memory into the state saved by the snapshot
+    void restore( const Snapshot& snapshot);
 };
 
+inline uint8* FuncMemory::translate( uint64 addr, uint64 size, const uint64*& shadow,
+                                     Permission perm) const
+{
+    uint64 tag = addr >> this->offset_bits;
+
+    if ( this->flat_pages != NULL)
+    {
+        const Page& page = this->flat_pages[ tag];
+        if ( ( page.perms & perm) == 0 && page.data != NULL)
+            this->accessFault( addr, perm);
+
+        shadow = page.shadow;
+        return page.data;
+    }
+
+    TlbEntry& entry = this->tlb[ tag & ( TLB_SIZE - 1)];
+
+    if ( entry.tag == tag && ( entry.perms & perm) != 0)
+    {
+        ++this->tlb_hits;
+        shadow = entry.shadow;
+        return entry.data;
+    }
+
+    ++this->tlb_misses;
+    Page* page = this->getPage( addr);
+
+    // not allocated pages are not cached, so that
+    // a write allocating the page need not flush the TLB
+    if ( page == NULL)
+        return NULL;
+
+    if ( ( page->perms & perm) == 0)
+        this->accessFault( addr, perm);
+
+    shadow = page->shadow;
+
+    // watched pages are not cached to take this path on each access
+    if ( this->watched_sets != NULL && this->isWatched( tag))
+    {
+        this->checkWatchpoints( addr, size, false);
+        return page->data;
+    }
+
+    // A write through the entry skips the dirty marking, so the entry
+    // allows writes only to a private page already marked as dirty.
+    entry.tag = tag;
+    entry.data = page->data;
+    entry.shadow = page->shadow;
+    entry.perms = page->ref_count == 1 && this->isDirty( tag) ? page->perms
+                                                              : page->perms & ~PERM_WRITE;
+    return page->data;
+}
+
+inline uint8* FuncMemory::translateForWrite( uint64 addr, uint64 size, uint64*& shadow)
+{
+    uint64 tag = addr >> this->offset_bits;
+
+    if ( this->flat_pages != NULL)
+    {
+        Page* page = &this->flat_pages[ tag];
+        if ( page->data == NULL || !this->isDirty( tag))
+            page = this->getOrAllocPage( addr);
+
+        if ( ( page->perms & PERM_WRITE) == 0)
+            this->accessFault( addr, PERM_WRITE);
+
+        shadow = page->shadow;
+        return page->data;
+    }
+
+    TlbEntry& entry = this->tlb[ tag & ( TLB_SIZE - 1)];
+
+    if ( entry.tag == tag && ( entry.perms & PERM_WRITE) != 0)
+    {
+        ++this->tlb_hits;
+        shadow = entry.shadow;
+        return entry.data;
+    }
+
+    ++this->tlb_misses;
+
+    // the callback sees the memory before the write
+    if ( this->watched_sets != NULL && this->isWatched( tag))
+    {
+        this->checkWatchpoints( addr, size, true);
+        Page* page = this->getOrAllocPage( addr);
+        if ( ( page->perms & PERM_WRITE) == 0)
+            this->accessFault( addr, PERM_WRITE);
+
+        shadow = page->shadow;
+        return page->data;
+    }
+
+    Page* page = this->getOrAllocPage( addr);
+    if ( ( page->perms & PERM_WRITE) == 0)
+        this->accessFault( addr, PERM_WRITE);
+
+    entry.tag = tag;
+    entry.data = page->data;
+    entry.shadow = page->shadow;
+    entry.perms = page->perms;
+    shadow = page->shadow;
+    return page->data;
+}
+
+inline uint8* FuncMemory::translateShared( uint64 addr, const uint64*& shadow) const
+{
+    const Page* page = this->getPageShared( addr);
+    if ( page == NULL)
+        return NULL;
+
+    if ( ( page->perms & PERM_READ) == 0)
+        this->accessFault( addr, PERM_READ);
+
+    // the fields are set before the page is published
+    shadow = page->shadow;
+    return page->data;
+}
+
+inline uint8* FuncMemory::translateForWriteShared( uint64 addr, uint64*& shadow)
+{
+    Page* page = this->getOrAllocPageShared( addr);
+    if ( ( page->perms & PERM_WRITE) == 0)
+        this->accessFault( addr, PERM_WRITE);
+
+    shadow = page->shadow;
+    return page->data;
+}
+
+template<typename Sync>
+inline bool FuncMemory::isInitialized( const uint64* shadow, uint64 offset, uint64 size)
+{
+    while ( size > 0)
+    {
+        uint64 shift = offset % 64;
+        uint64 chunk = size < 64 - shift ? size : 64 - shift;
+        uint64 mask = ( chunk == 64 ? MAX_VAL64 : ( ( uint64)1 << chunk) - 1) << shift;
+
+        if ( ( Sync::load( &shadow[ offset / 64]) & mask) != mask)
+            return false;
+
+        offset += chunk;
+        size -= chunk;
+    }
+    return true;
+}
+
+template<typename Sync>
+inline void FuncMemory::setInitialized( uint64* shadow, uint64 offset, uint64 size)
+{
+    while ( size > 0)
+    {
+        uint64 shift = offset % 64;
+        uint64 chunk = size < 64 - shift ? size : 64 - shift;
+        uint64 mask = ( chunk == 64 ? MAX_VAL64 : ( ( uint64)1 << chunk) - 1) << shift;
+
+        Sync::setBits( &shadow[ offset / 64], mask);
+
+        offset += chunk;
+        size -= chunk;
+    }
+}
+
+inline bool FuncMemory::isDirty( uint64 tag) const
+{
+    if ( this->flat_dirty != NULL)
+        return ( ( this->flat_dirty[ tag / 64] >> ( tag % 64)) & 1) != 0;
+
+    const uint64* dirty = ( const uint64*)this->dirty_sets->find( tag >> this->page_bits);
+    uint64 page_num = tag & this->page_mask;
+    return dirty != NULL && ( ( dirty[ page_num / 64] >> ( page_num % 64)) & 1) != 0;
+}
+
+template<typename Sync>
+inline void FuncMemory::countAccess( uint64 addr, HeatKind kind) const
+{
+    if ( !FUNC_MEMORY_HEAT_COUNT)
+        return;
+
+    uint64 tag = addr >> this->offset_bits;
+    uint64 set = tag >> this->page_bits;
+
+    PageHeat* heat = ( PageHeat*)( Sync::CONCURRENT ? this->heat_sets->findShared( set)
+                                                    : this->heat_sets->find( set));
+    if ( heat == NULL)
+        heat = this->allocHeat( set, Sync::CONCURRENT);
+
+    Sync::add( &heat[ tag & this->page_mask].counters[ kind], 1);
+}
+
+template<typename T, ByteOrder ORDER, typename Sync>
+T FuncMemory::read( uint64 addr) const
+{
+    T value = this->readUncounted<T, ORDER, Sync>( addr);
+    this->countAccess<Sync>( addr, HEAT_READ);
+    return value;
+}
+
+template<typename T, ByteOrder ORDER, typename Sync>
+void FuncMemory::write( T value, uint64 addr)
+{
+    this->writeUncounted<T, ORDER, Sync>( value, addr);
+    this->countAccess<Sync>( addr, HEAT_WRITE);
+}
+
+template<typename T, ByteOrder ORDER, typename Sync>
+T FuncMemory::readUncounted( uint64 addr) const
+{
+    uint64 offset = this->getOffset( addr);
+
+    if ( offset + sizeof( T) > this->page_size || ( addr & ~this->addr_mask) != 0)
+    {
+        return ( T)( Sync::CONCURRENT ? this->readBytesShared( addr, sizeof( T), ORDER)
+                                      : this->readBytes( addr, sizeof( T), ORDER));
+    }
+
+    const uint64* shadow;
+    const uint8* page = Sync::CONCURRENT ? this->translateShared( addr, shadow)
+                                         : this->translate( addr, sizeof( T), shadow);
+
+    // reading of not initialized or written data is prohibited
+    assert( page != NULL);
+    assert( !FUNC_MEMORY_INIT_CHECK || shadow == NULL ||
+            isInitialized<Sync>( shadow, offset, sizeof( T)));
+
+    T value = Sync::load( ( const T*)( page + offset));
+    return convertByteOrder<ORDER>( value);
+}
+
+template<typename T, ByteOrder ORDER, typename Sync>
+void FuncMemory::writeUncounted( T value, uint64 addr)
+{
+    uint64 offset = this->getOffset( addr);
+
+    if ( offset + sizeof( T) > this->page_size || ( addr & ~this->addr_mask) != 0)
+    {
+        if ( Sync::CONCURRENT)
+            this->writeBytesShared( value, addr, sizeof( T), ORDER);
+        else
+            this->writeBytes( value, addr, sizeof( T), ORDER);
+        return;
+    }
+
+    uint64* shadow;
+    uint8* page = Sync::CONCURRENT ? this->translateForWriteShared( addr, shadow)
+                                   : this->translateForWrite( addr, sizeof( T), shadow);
+
+    Sync::store( ( T*)( page + offset), convertByteOrder<ORDER>( value));
+
+    if ( FUNC_MEMORY_INIT_CHECK && shadow != NULL)
+        setInitialized<Sync>( shadow, offset, sizeof( T));
+}
+
+template<typename T>
+T FuncMemory::read( uint64 addr) const
+{
+    return this->byte_order == BIG_ENDIAN_ORDER
+           ? this->read<T, BIG_ENDIAN_ORDER>( addr)
+           : this->read<T, LITTLE_ENDIAN_ORDER>( addr);
+}
+
+template<typename T>
+void FuncMemory::write( T value, uint64 addr)
+{
+    if ( this->byte_order == BIG_ENDIAN_ORDER)
+        this->write<T, BIG_ENDIAN_ORDER>( value, addr);
+    else
+        this->write<T, LITTLE_ENDIAN_ORDER>( value, addr);
+}
+
 #endif // #ifndef FUNC_MEMORY__FUNC_MEMORY_H
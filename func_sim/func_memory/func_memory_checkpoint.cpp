@@ -0,0 +1,376 @@
+/**
+ * func_memory_checkpoint.cpp - incremental checkpoints of
+ * the functional memory.
+ * Copyright 2015 MIPT-MIPS iLab project
+ */
+
+// Generic C
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+
+// Generic C++
+#include <iostream>
+#include <vector>
+
+// uArchSim modules
+#include <func_memory.h>
+
+//
+// A checkpoint file consists of the header and the pages:
+//
+//   magic, addr_size, page_num_size, offset_size, start PC,
+//   flags, number of pages               - 64-bit words each
+//   page tag, permissions, page flags,   - repeated for each page
+//   size of the content, content,
+//   bitmap of the written bytes if the page has one
+//
+// The content is either the raw page or its PackBits encoding,
+// whatever is shorter: a byte n < 128 is followed by n + 1 literal
+// bytes, a byte n > 128 is followed by a byte repeated 257 - n times.
+// The words are little-endian on any host, so the checkpoints can be
+// moved between hosts. A checkpoint is loaded by a single read.
+//
+static const uint64 CHECKPOINT_MAGIC = 0x3430544b43454d46ULL; // "FMECKT04"
+static const uint64 CHECKPOINT_FULL = 0x1; // the checkpoint has all the pages
+static const uint64 CHECKPOINT_BIG_ENDIAN = 0x2; // the guest is big-endian
+static const uint64 CHECKPOINT_HEADER_SIZE = 7; // in words
+
+static const uint64 PAGE_ENCODED = 0x1; // the content is PackBits-encoded
+static const uint64 PAGE_SHADOW = 0x2;  // the bitmap follows the content
+
+static FILE* openCheckpoint( const char* file_name, const char* mode)
+{
+    FILE* file = fopen( file_name, mode);
+    if ( file == NULL)
+    {
+        cerr << "ERROR: Could not open checkpoint " << file_name << ": "
+             << strerror( errno) << endl;
+        exit( EXIT_FAILURE);
+    }
+    return file;
+}
+
+static void writeCheckpoint( const void* data, size_t size, FILE* file, const char* file_name)
+{
+    if ( size > 0 && fwrite( data, size, 1, file) != 1)
+    {
+        cerr << "ERROR: Could not write checkpoint " << file_name << ": "
+             << strerror( errno) << endl;
+        exit( EXIT_FAILURE);
+    }
+}
+
+static void writeCheckpointWords( const uint64* words, size_t num, FILE* file, const char* file_name)
+{
+    for ( size_t i = 0; i < num; ++i)
+    {
+        uint64 word = convertByteOrder<LITTLE_ENDIAN_ORDER>( words[ i]);
+        writeCheckpoint( &word, sizeof( word), file, file_name);
+    }
+}
+
+// reads the whole file into the buffer at once
+static void loadFile( const char* file_name, vector<uint8>& buffer)
+{
+    FILE* file = openCheckpoint( file_name, "rb");
+
+    if ( fseek( file, 0, SEEK_END) != 0)
+    {
+        cerr << "ERROR: Could not read checkpoint " << file_name << ": "
+             << strerror( errno) << endl;
+        exit( EXIT_FAILURE);
+    }
+    long size = ftell( file);
+    rewind( file);
+
+    buffer.resize( size > 0 ? size : 0);
+    if ( size > 0 && fread( &buffer[ 0], size, 1, file) != 1)
+    {
+        cerr << "ERROR: Could not read checkpoint " << file_name << ": "
+             << strerror( errno) << endl;
+        exit( EXIT_FAILURE);
+    }
+
+    fclose( file);
+}
+
+// returns the given number of bytes at the position and moves it
+static const uint8* readCheckpoint( const vector<uint8>& buffer, uint64& pos,
+                                    uint64 size, const char* file_name)
+{
+    if ( size > buffer.size() - pos)
+    {
+        cerr << "ERROR: Could not read checkpoint " << file_name
+             << ": the file is truncated" << endl;
+        exit( EXIT_FAILURE);
+    }
+
+    const uint8* data = buffer.empty() ? NULL : &buffer[ 0] + pos;
+    pos += size;
+    return data;
+}
+
+static void readCheckpointWords( const vector<uint8>& buffer, uint64& pos,
+                                 uint64* words, size_t num, const char* file_name)
+{
+    const uint8* data = readCheckpoint( buffer, pos, num * sizeof( uint64), file_name);
+    for ( size_t i = 0; i < num; ++i)
+    {
+        memcpy( &words[ i], data + i * sizeof( uint64), sizeof( uint64));
+        words[ i] = convertByteOrder<LITTLE_ENDIAN_ORDER>( words[ i]);
+    }
+}
+
+// Encodes the data by PackBits. Returns the size of the encoding
+// or 0 if it is not shorter than the data, the output buffer must
+// have the size of the data.
+static uint64 encodeRuns( const uint8* data, uint64 size, uint8* out)
+{
+    uint64 pos = 0;
+    uint64 out_pos = 0;
+
+    while ( pos < size)
+    {
+        uint64 run = 1;
+        while ( pos + run < size && run < 128 && data[ pos + run] == data[ pos])
+            ++run;
+
+        // the runs shorter than 3 bytes are cheaper as literals
+        if ( run >= 3)
+        {
+            if ( out_pos + 2 >= size)
+                return 0;
+
+            out[ out_pos++] = ( uint8)( 257 - run);
+            out[ out_pos++] = data[ pos];
+            pos += run;
+            continue;
+        }
+
+        // the literal lasts up to the next run of 3 bytes
+        uint64 literal = 1;
+        while ( pos + literal < size && literal < 128 &&
+                !( pos + literal + 2 < size &&
+                   data[ pos + literal] == data[ pos + literal + 1] &&
+                   data[ pos + literal] == data[ pos + literal + 2]))
+        {
+            ++literal;
+        }
+
+        if ( out_pos + 1 + literal >= size)
+            return 0;
+
+        out[ out_pos++] = ( uint8)( literal - 1);
+        memcpy( out + out_pos, data + pos, literal);
+        out_pos += literal;
+        pos += literal;
+    }
+
+    return out_pos;
+}
+
+// decodes PackBits, returns false if the encoding does not fill the data exactly
+static bool decodeRuns( const uint8* in, uint64 in_size, uint8* data, uint64 size)
+{
+    uint64 in_pos = 0;
+    uint64 pos = 0;
+
+    while ( in_pos < in_size)
+    {
+        uint8 header = in[ in_pos++];
+        if ( header < 128)
+        {
+            uint64 literal = header + 1;
+            if ( literal > in_size - in_pos || literal > size - pos)
+                return false;
+
+            memcpy( data + pos, in + in_pos, literal);
+            in_pos += literal;
+            pos += literal;
+        } else
+        {
+            uint64 run = 257 - header;
+            if ( header == 128 || in_pos == in_size || run > size - pos)
+                return false;
+
+            memset( data + pos, in[ in_pos++], run);
+            pos += run;
+        }
+    }
+
+    return pos == size;
+}
+
+FuncMemory::FuncMemory( const vector<string>& checkpoint_files,
+                        Backend backend,
+                        bool use_huge_pages)
+{
+    if ( checkpoint_files.empty())
+    {
+        cerr << "ERROR: no checkpoint files are given" << endl;
+        exit( EXIT_FAILURE);
+    }
+
+    // the first checkpoint is read once, its header gives the configuration
+    vector<uint8> buffer;
+    loadFile( checkpoint_files[ 0].c_str(), buffer);
+
+    uint64 pos = 0;
+    uint64 header[ CHECKPOINT_HEADER_SIZE];
+    readCheckpointWords( buffer, pos, header, CHECKPOINT_HEADER_SIZE,
+                         checkpoint_files[ 0].c_str());
+
+    if ( header[ 0] != CHECKPOINT_MAGIC)
+    {
+        cerr << "ERROR: " << checkpoint_files[ 0] << " is not a checkpoint file" << endl;
+        exit( EXIT_FAILURE);
+    }
+
+    this->init( header[ 1], header[ 2], header[ 3], backend, use_huge_pages);
+
+    this->replayCheckpoint( buffer, checkpoint_files[ 0].c_str());
+    for ( size_t i = 1; i < checkpoint_files.size(); ++i)
+        this->loadCheckpoint( checkpoint_files[ i].c_str());
+
+    // the memory is in the state of the last checkpoint
+    this->clearDirty();
+}
+
+void FuncMemory::saveCheckpoint( const char* file_name)
+{
+    FILE* file = openCheckpoint( file_name, "wb");
+
+    uint64 header[ CHECKPOINT_HEADER_SIZE] =
+        { CHECKPOINT_MAGIC, this->addr_size, this->page_bits,
+          this->offset_bits, this->start_pc,
+          ( this->checkpoint_full ? CHECKPOINT_FULL : 0) |
+          ( this->byte_order == BIG_ENDIAN_ORDER ? CHECKPOINT_BIG_ENDIAN : 0),
+          this->dirtyPagesNum() };
+    writeCheckpointWords( header, CHECKPOINT_HEADER_SIZE, file, file_name);
+
+    uint64 shadow_words_num = this->shadow_arena->blockSize() / sizeof( uint64);
+    vector<uint8> encoded( this->page_size);
+
+    uint64 tag = 0;
+    for ( const Page* page = this->findPage( tag); page != NULL;
+          page = this->findPage( ++tag))
+    {
+        if ( !this->checkpoint_full && !this->isDirty( tag))
+            continue;
+
+        uint64 encoded_size = encodeRuns( page->data, this->page_size, &encoded[ 0]);
+
+        // the pages written entirely have no bitmap
+        uint64 record[ 4] = { tag, page->perms,
+                              ( encoded_size != 0 ? PAGE_ENCODED : 0) |
+                              ( page->shadow != NULL ? PAGE_SHADOW : 0),
+                              encoded_size != 0 ? encoded_size : this->page_size };
+        writeCheckpointWords( record, 4, file, file_name);
+
+        writeCheckpoint( encoded_size != 0 ? &encoded[ 0] : page->data,
+                         record[ 3], file, file_name);
+
+        if ( page->shadow != NULL)
+            writeCheckpointWords( page->shadow, shadow_words_num, file, file_name);
+    }
+
+    fclose( file);
+
+    this->clearDirty();
+}
+
+void FuncMemory::loadCheckpoint( const char* file_name)
+{
+    vector<uint8> buffer;
+    loadFile( file_name, buffer);
+    this->replayCheckpoint( buffer, file_name);
+}
+
+void FuncMemory::replayCheckpoint( const vector<uint8>& buffer, const char* file_name)
+{
+    uint64 pos = 0;
+    uint64 header[ CHECKPOINT_HEADER_SIZE];
+    readCheckpointWords( buffer, pos, header, CHECKPOINT_HEADER_SIZE, file_name);
+
+    if ( header[ 0] != CHECKPOINT_MAGIC)
+    {
+        cerr << "ERROR: " << file_name << " is not a checkpoint file" << endl;
+        exit( EXIT_FAILURE);
+    }
+
+    if ( header[ 1] != this->addr_size || header[ 2] != this->page_bits ||
+         header[ 3] != this->offset_bits)
+    {
+        cerr << "ERROR: checkpoint " << file_name
+             << " is saved by a memory of another configuration" << endl;
+        exit( EXIT_FAILURE);
+    }
+
+    this->start_pc = header[ 4];
+    this->byte_order = ( header[ 5] & CHECKPOINT_BIG_ENDIAN) != 0
+                       ? BIG_ENDIAN_ORDER
+                       : LITTLE_ENDIAN_ORDER;
+
+    if ( ( header[ 5] & CHECKPOINT_FULL) != 0)
+        this->clear();
+
+    uint64 shadow_words_num = this->shadow_arena->blockSize() / sizeof( uint64);
+    vector<uint64> shadow( shadow_words_num);
+
+    for ( uint64 i = 0; i < header[ 6]; ++i)
+    {
+        // tag, permissions, flags and size of the content
+        uint64 record[ 4];
+        readCheckpointWords( buffer, pos, record, 4, file_name);
+
+        uint64 tag = record[ 0];
+        uint64 flags = record[ 2];
+        uint64 size = record[ 3];
+
+        if ( tag >= this->tags_num || ( record[ 1] & ~( uint64)PERM_ALL) != 0 ||
+             ( ( flags & PAGE_ENCODED) == 0 && size != this->page_size))
+        {
+            cerr << "ERROR: checkpoint " << file_name << " is corrupted" << endl;
+            exit( EXIT_FAILURE);
+        }
+
+        const uint8* content = readCheckpoint( buffer, pos, size, file_name);
+
+        // decode the content right into the page
+        uint64 addr = tag << this->offset_bits;
+        Page* page = this->getOrAllocPage( addr);
+        page->perms = ( uint32)record[ 1];
+
+        if ( ( flags & PAGE_ENCODED) == 0)
+        {
+            memcpy( page->data, content, this->page_size);
+        } else if ( !decodeRuns( content, size, page->data, this->page_size))
+        {
+            cerr << "ERROR: checkpoint " << file_name << " is corrupted" << endl;
+            exit( EXIT_FAILURE);
+        }
+
+        if ( ( flags & PAGE_SHADOW) == 0)
+        {
+            this->markInitialized( page->shadow, addr, this->page_size);
+            continue;
+        }
+
+        readCheckpointWords( buffer, pos, &shadow[ 0], shadow_words_num, file_name);
+        if ( isInitialized( &shadow[ 0], 0, this->page_size))
+        {
+            this->markInitialized( page->shadow, addr, this->page_size);
+        } else if ( page->shadow != NULL)
+        {
+            memcpy( page->shadow, &shadow[ 0], shadow_words_num * sizeof( uint64));
+        } else
+        {
+            page->shadow = this->allocShadow( &shadow[ 0]);
+        }
+    }
+
+    // the pages could be reallocated if they were shared
+    this->flushTlb();
+}
@@ -0,0 +1,259 @@
+/**
+ * func_memory_image.cpp - images of the functional memory
+ * to be mapped from the disk.
+ * Copyright 2015 MIPT-MIPS iLab project
+ */
+
+// Generic C
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Generic C++
+#include <iostream>
+#include <vector>
+
+// uArchSim modules
+#include <func_memory.h>
+
+//
+// An image file consists of the header, the index of pages,
+// the page contents and the bitmaps of written bytes:
+//
+//   magic, addr_size, page_num_size, offset_size, start PC,
+//   flags, number of pages, number of bitmaps  - 64-bit words each
+//   page tag, number of the bitmap,            - repeated for each page,
+//   permissions of the page                      NO_VAL64 if no bitmap
+//   page contents                              - aligned by IMAGE_ALIGNMENT
+//   bitmaps
+//
+// The page contents are aligned, so the pages of a big enough size
+// can be mapped right into the flat mapping. The words are written
+// in the host byte order.
+//
+static const uint64 IMAGE_MAGIC = 0x3230474d49454d46ULL; // "FMEIMG02"
+static const uint64 IMAGE_BIG_ENDIAN = 0x1; // the guest is big-endian
+static const uint64 IMAGE_HEADER_SIZE = 8;  // in words
+static const uint64 IMAGE_ALIGNMENT = 64 * 1024; // not less than a host page
+static const uint64 IMAGE_INDEX_ENTRY_SIZE = 3; // in words
+
+static void writeImage( const void* data, size_t size, FILE* file, const char* file_name)
+{
+    if ( size > 0 && fwrite( data, size, 1, file) != 1)
+    {
+        cerr << "ERROR: Could not write image " << file_name << ": "
+             << strerror( errno) << endl;
+        exit( EXIT_FAILURE);
+    }
+}
+
+static uint64 alignUp( uint64 value, uint64 alignment)
+{
+    return ( value + alignment - 1) / alignment * alignment;
+}
+
+void FuncMemory::saveImage( const char* file_name) const
+{
+    FILE* file = fopen( file_name, "wb");
+    if ( file == NULL)
+    {
+        cerr << "ERROR: Could not open image " << file_name << ": "
+             << strerror( errno) << endl;
+        exit( EXIT_FAILURE);
+    }
+
+    // the index is built first as the header has the numbers of pages and bitmaps
+    vector<uint64> index;
+    vector<const Page*> pages;
+    uint64 shadows_num = 0;
+
+    uint64 tag = 0;
+    for ( const Page* page = this->findPage( tag); page != NULL;
+          page = this->findPage( ++tag))
+    {
+        index.push_back( tag);
+        index.push_back( page->shadow != NULL ? shadows_num++ : NO_VAL64);
+        index.push_back( page->perms);
+        pages.push_back( page);
+    }
+
+    uint64 header[ IMAGE_HEADER_SIZE] = { IMAGE_MAGIC, this->addr_size, this->page_bits,
+                                          this->offset_bits, this->start_pc,
+                                          this->byte_order == BIG_ENDIAN_ORDER ? IMAGE_BIG_ENDIAN : 0,
+                                          pages.size(), shadows_num };
+    writeImage( header, sizeof( header), file, file_name);
+    if ( !index.empty())
+        writeImage( &index[ 0], index.size() * sizeof( uint64), file, file_name);
+
+    uint64 data_pos = alignUp( ( IMAGE_HEADER_SIZE + index.size()) * sizeof( uint64),
+                               IMAGE_ALIGNMENT);
+    if ( fseek( file, data_pos, SEEK_SET) != 0)
+    {
+        cerr << "ERROR: Could not write image " << file_name << ": "
+             << strerror( errno) << endl;
+        exit( EXIT_FAILURE);
+    }
+
+    for ( size_t i = 0; i < pages.size(); ++i)
+        writeImage( pages[ i]->data, this->page_size, file, file_name);
+
+    for ( size_t i = 0; i < pages.size(); ++i)
+        if ( pages[ i]->shadow != NULL)
+            writeImage( pages[ i]->shadow, this->shadow_arena->blockSize(), file, file_name);
+
+    fclose( file);
+}
+
+FuncMemory::FuncMemory( ImageTag,
+                        const char* image_file_name,
+                        Backend backend,
+                        bool use_huge_pages)
+{
+    int file_descr = open( image_file_name, O_RDONLY);
+    struct stat file_stat;
+    if ( file_descr < 0 || fstat( file_descr, &file_stat) != 0)
+    {
+        cerr << "ERROR: Could not open image " << image_file_name << ": "
+             << strerror( errno) << endl;
+        exit( EXIT_FAILURE);
+    }
+
+    uint64 file_size = file_stat.st_size;
+    if ( file_size < IMAGE_HEADER_SIZE * sizeof( uint64))
+    {
+        cerr << "ERROR: " << image_file_name << " is not an image file" << endl;
+        exit( EXIT_FAILURE);
+    }
+
+    // the private mapping makes the writes to the pages copy them
+    void* base = mmap( NULL, file_size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE, file_descr, 0);
+    if ( base == MAP_FAILED)
+    {
+        cerr << "ERROR: Could not map image " << image_file_name << ": "
+             << strerror( errno) << endl;
+        exit( EXIT_FAILURE);
+    }
+
+    const uint64* header = ( const uint64*)base;
+    if ( header[ 0] != IMAGE_MAGIC)
+    {
+        cerr << "ERROR: " << image_file_name << " is not an image file" << endl;
+        exit( EXIT_FAILURE);
+    }
+
+    this->init( header[ 1], header[ 2], header[ 3], backend, use_huge_pages);
+    this->image_base = ( uint8*)base;
+    this->image_size = file_size;
+
+    this->start_pc = header[ 4];
+    this->byte_order = ( header[ 5] & IMAGE_BIG_ENDIAN) != 0
+                       ? BIG_ENDIAN_ORDER
+                       : LITTLE_ENDIAN_ORDER;
+
+    uint64 pages_num = header[ 6];
+    uint64 shadow_size = this->shadow_arena->blockSize();
+    const uint64* index = header + IMAGE_HEADER_SIZE;
+
+    uint64 index_size = ( IMAGE_HEADER_SIZE + IMAGE_INDEX_ENTRY_SIZE * pages_num) * sizeof( uint64);
+    uint64 data_pos = alignUp( index_size, IMAGE_ALIGNMENT);
+    uint64 shadow_pos = data_pos + pages_num * this->page_size;
+
+    if ( index_size > file_size ||
+         shadow_pos + header[ 7] * shadow_size != file_size)
+    {
+        cerr << "ERROR: image " << image_file_name << " is corrupted" << endl;
+        exit( EXIT_FAILURE);
+    }
+
+    // pages of the flat mapping are mapped from the file if they
+    // are aligned with the host pages, otherwise they are copied
+    uint64 host_page_size = sysconf( _SC_PAGESIZE);
+    bool map_flat_pages = this->page_size % host_page_size == 0;
+
+    // the index is sorted by the tags
+    uint64 min_tag = 0;
+
+    for ( uint64 i = 0; i < pages_num; ++i)
+    {
+        const uint64* entry = index + IMAGE_INDEX_ENTRY_SIZE * i;
+        uint64 tag = entry[ 0];
+        uint64 shadow_num = entry[ 1];
+
+        if ( tag >= this->tags_num || tag < min_tag ||
+             ( shadow_num != NO_VAL64 && shadow_num >= header[ 7]) ||
+             ( entry[ 2] & ~( uint64)PERM_ALL) != 0)
+        {
+            cerr << "ERROR: image " << image_file_name << " is corrupted" << endl;
+            exit( EXIT_FAILURE);
+        }
+
+        uint64 addr = tag << this->offset_bits;
+        uint8* data = this->image_base + data_pos + i * this->page_size;
+        uint64* shadow = shadow_num == NO_VAL64 || !FUNC_MEMORY_INIT_CHECK
+                         ? NULL
+                         : ( uint64*)( this->image_base + shadow_pos + shadow_num * shadow_size);
+
+        if ( this->flat_pages != NULL)
+        {
+            Page* page = &this->flat_pages[ tag];
+            page->data = this->flat_base + addr;
+            page->ref_count = 1;
+            page->perms = ( uint32)entry[ 2];
+            page->shadow = shadow;
+
+            // the pages of consecutive tags are mapped at once, a corrupted
+            // index must not lead the run out of the address space
+            uint64 run = 1;
+            while ( i + run < pages_num && tag + run < this->tags_num &&
+                    entry[ IMAGE_INDEX_ENTRY_SIZE * run] == tag + run)
+            {
+                Page* next = &this->flat_pages[ tag + run];
+                const uint64* next_entry = entry + IMAGE_INDEX_ENTRY_SIZE * run;
+                uint64 next_shadow_num = next_entry[ 1];
+                if ( ( next_shadow_num != NO_VAL64 && next_shadow_num >= header[ 7]) ||
+                     ( next_entry[ 2] & ~( uint64)PERM_ALL) != 0)
+                {
+                    break;
+                }
+
+                next->data = page->data + run * this->page_size;
+                next->ref_count = 1;
+                next->perms = ( uint32)next_entry[ 2];
+                next->shadow = next_shadow_num == NO_VAL64 || !FUNC_MEMORY_INIT_CHECK
+                               ? NULL
+                               : ( uint64*)( this->image_base + shadow_pos +
+                                             next_shadow_num * shadow_size);
+                ++run;
+            }
+
+            uint64 run_size = run * this->page_size;
+            if ( !map_flat_pages ||
+                 mmap( page->data, run_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED,
+                       file_descr, data - this->image_base) == MAP_FAILED)
+            {
+                memcpy( page->data, data, run_size);
+            }
+
+            i += run - 1;
+            min_tag = tag + run;
+            continue;
+        }
+
+        // the data stays in the mapping and is read on the first access
+        Page*& page = this->getOrAllocDir( addr)[ this->getPageNum( addr)];
+        page = ( Page*)this->page_info_arena->allocate( false);
+        page->data = data;
+        page->ref_count = 1;
+        page->perms = ( uint32)entry[ 2];
+        page->shadow = shadow;
+        min_tag = tag + 1;
+    }
+
+    close( file_descr);
+}
@@ -0,0 +1,145 @@
+/**
+ * page_arena.cpp - the allocator of equal-sized blocks
+ * (e.g. guest pages) carved out of large host memory chunks.
+ * Copyright 2015 MIPT-MIPS iLab project
+ */
+
+// Generic C
+#include <cstdlib>
+#include <cstring>
+#include <cassert>
+#include <sys/mman.h>
+
+// Generic C++
+#include <iostream>
+
+// uArchSim modules
+#include <page_arena.h>
+
+const uint64 PageArena::DEFAULT_CHUNK_SIZE;
+const uint64 PageArena::HUGE_PAGE_SIZE;
+
+PageArena::PageArena( uint64 block_size,
+                      uint64 min_chunk_size,
+                      bool use_huge_pages)
+    : block_size( block_size),
+      use_huge_pages( use_huge_pages),
+      huge_pages( HUGE_PAGES_NONE),
+      chunk_pos( NULL),
+      chunk_end( NULL),
+      free_list( NULL),
+      used_blocks( 0),
+      peak_used_blocks( 0)
+{
+    // the free list is linked through the blocks
+    assert( block_size >= sizeof( void*));
+
+    // a chunk keeps a whole number of blocks
+    this->chunk_size = block_size >= min_chunk_size
+                       ? block_size
+                       : ( min_chunk_size / block_size) * block_size;
+
+    // huge pages can back only whole huge pages of the chunk
+    if ( use_huge_pages)
+        this->chunk_size = ( this->chunk_size + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+}
+
+PageArena::~PageArena()
+{
+    for ( size_t i = 0; i < this->chunks.size(); ++i)
+        munmap( this->chunks[ i], this->chunk_size);
+}
+
+uint8* PageArena::allocate( bool zeroed)
+{
+    uint8* block;
+
+    if ( this->free_list != NULL)
+    {
+        block = ( uint8*)this->free_list;
+        this->free_list = *( void**)this->free_list;
+
+        if ( zeroed)
+            memset( block, 0, this->block_size);
+    } else
+    {
+        if ( this->chunk_pos == this->chunk_end)
+        {
+            uint8* chunk = this->mapChunk();
+
+            this->chunks.push_back( chunk);
+            this->chunk_pos = chunk;
+            this->chunk_end = chunk + this->chunk_size;
+        }
+
+        block = this->chunk_pos;
+        this->chunk_pos += this->block_size;
+    }
+
+    if ( ++this->used_blocks > this->peak_used_blocks)
+        this->peak_used_blocks = this->used_blocks;
+
+    return block;
+}
+
+uint8* PageArena::mapChunk()
+{
+    // the anonymous mapping is zeroed and committed
+    // by the OS only when it is touched
+    const int prot = PROT_READ | PROT_WRITE;
+    const int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+    HugePages chunk_huge_pages = HUGE_PAGES_NONE;
+    void* chunk = MAP_FAILED;
+
+    if ( this->use_huge_pages)
+    {
+#ifdef MAP_HUGETLB
+        chunk = mmap( NULL, this->chunk_size, prot, flags | MAP_HUGETLB, -1, 0);
+        if ( chunk != MAP_FAILED)
+            chunk_huge_pages = HUGE_PAGES_RESERVED;
+#endif
+        if ( chunk == MAP_FAILED)
+        {
+            // there are no reserved huge pages, so map a bit more to align
+            // the chunk to the huge page size and cut off the rest
+            uint8* area = ( uint8*)mmap( NULL, this->chunk_size + HUGE_PAGE_SIZE,
+                                         prot, flags, -1, 0);
+            if ( area != MAP_FAILED)
+            {
+                uint64 head = ( HUGE_PAGE_SIZE - ( uint64)area % HUGE_PAGE_SIZE) % HUGE_PAGE_SIZE;
+                if ( head > 0)
+                    munmap( area, head);
+                munmap( area + head + this->chunk_size, HUGE_PAGE_SIZE - head);
+                chunk = area + head;
+#ifdef MADV_HUGEPAGE
+                if ( madvise( chunk, this->chunk_size, MADV_HUGEPAGE) == 0)
+                    chunk_huge_pages = HUGE_PAGES_TRANSPARENT;
+#endif
+            }
+        }
+    } else
+    {
+        chunk = mmap( NULL, this->chunk_size, prot, flags, -1, 0);
+    }
+
+    if ( chunk == MAP_FAILED)
+    {
+        cerr << "ERROR: could not allocate " << this->chunk_size
+             << " bytes of the host memory" << endl;
+        exit( EXIT_FAILURE);
+    }
+
+    if ( this->chunks.empty() || chunk_huge_pages < this->huge_pages)
+        this->huge_pages = chunk_huge_pages;
+
+    return ( uint8*)chunk;
+}
+
+void PageArena::release( void* block)
+{
+    assert( this->used_blocks > 0);
+    --this->used_blocks;
+
+    *( void**)block = this->free_list;
+    this->free_list = block;
+}
@@ -0,0 +1,86 @@
+/**
+ * page_arena.h - Header of the allocator of equal-sized blocks
+ * (e.g. guest pages) carved out of large host memory chunks.
+ * Copyright 2015 MIPT-MIPS iLab project
+ */
+
+// protection from multi-include
+#ifndef FUNC_MEMORY__PAGE_ARENA_H
+#define FUNC_MEMORY__PAGE_ARENA_H
+
+// Generic C++
+#include <vector>
+
+// uArchSim modules
+#include <types.h>
+
+using namespace std;
+
+//
+// The arena maps host memory by chunks of at least min_chunk_size bytes
+// and splits them into blocks. A block of a power-of-2 size is aligned
+// to its size or to the chunk boundary, whatever is smaller. Released
+// blocks are kept in a free list for the reuse, all the chunks are
+// returned to the host at once by the destructor.
+//
+// The chunks can be backed by 2 MB huge pages to reduce host TLB misses.
+// Reserved huge pages (MAP_HUGETLB) are tried first, then the chunks
+// are aligned to 2 MB and advised to be backed by transparent huge pages.
+//
+class PageArena
+{
+public:
+    enum HugePages
+    {
+        HUGE_PAGES_NONE,        // the chunks are backed by ordinary pages
+        HUGE_PAGES_TRANSPARENT, // transparent huge pages are advised
+        HUGE_PAGES_RESERVED     // the chunks are taken from reserved huge pages
+    };
+
+private:
+    uint64 block_size;
+    uint64 chunk_size;
+
+    bool use_huge_pages;
+    HugePages huge_pages; // the worst backing among all the chunks
+
+    vector<uint8*> chunks;
+    uint8* chunk_pos; // the not yet used part
+    uint8* chunk_end; // of the last chunk
+
+    void* free_list; // released blocks linked through their first word
+
+    uint64 used_blocks;
+    uint64 peak_used_blocks;
+
+    // You could not create the object
+    // using this default constructor
+    PageArena(){}
+    PageArena( const PageArena&);
+    PageArena& operator=( const PageArena&);
+
+    uint8* mapChunk();
+
+public:
+    static const uint64 DEFAULT_CHUNK_SIZE = 2 * 1024 * 1024;
+    static const uint64 HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+    PageArena( uint64 block_size,
+               uint64 min_chunk_size = DEFAULT_CHUNK_SIZE,
+               bool use_huge_pages = false);
+    virtual ~PageArena();
+
+    // returns a block filled by zeros if it is requested
+    uint8* allocate( bool zeroed = true);
+    void   release( void* block);
+
+    uint64 blockSize() const { return this->block_size; }
+    // number of bytes taken from the host
+    uint64 footprint() const { return this->chunks.size() * this->chunk_size; }
+    // maximal number of bytes in the blocks used at the same time
+    uint64 peakUsage() const { return this->peak_used_blocks * this->block_size; }
+    // what kind of huge pages were actually obtained for the chunks
+    HugePages hugePages() const { return this->huge_pages; }
+};
+
+#endif // #ifndef FUNC_MEMORY__PAGE_ARENA_H
@@ -0,0 +1,183 @@
+/**
+ * radix_tree.cpp - the radix tree mapping sparse keys
+ * (e.g. the upper bits of guest addresses) to pointers.
+ * Copyright 2015 MIPT-MIPS iLab project
+ */
+
+// Generic C
+#include <cstdlib>
+#include <cstring>
+#include <cassert>
+
+// Generic C++
+#include <iostream>
+
+// uArchSim modules
+#include <radix_tree.h>
+
+const uint64 RadixTree::DEFAULT_NODE_BITS;
+
+RadixTree::RadixTree( uint64 key_bits, uint64 max_node_bits)
+    : key_bits( key_bits),
+      nodes_size( 0)
+{
+    assert( key_bits < 64 && max_node_bits > 0);
+
+    // the bits are spread over the levels evenly,
+    // the upper levels take the odd ones
+    this->levels_num = key_bits == 0 ? 1 : ( key_bits + max_node_bits - 1) / max_node_bits;
+
+    uint64 shift = key_bits;
+    for ( uint64 level = 0; level < this->levels_num; ++level)
+    {
+        uint64 levels_left = this->levels_num - level;
+        uint64 bits = ( shift + levels_left - 1) / levels_left;
+
+        shift -= bits;
+        this->level_shift[ level] = shift;
+        this->level_bits[ level] = bits;
+    }
+
+    this->root = this->allocNode( 0, 0);
+}
+
+RadixTree::~RadixTree()
+{
+    this->freeNodes( this->root, false);
+}
+
+RadixTree::Node* RadixTree::allocNode( uint64 level, uint64 key)
+{
+    uint64 entries_num = ( uint64)1 << this->level_bits[ level];
+    uint64 size = sizeof( Node) + ( entries_num - 1) * sizeof( void*);
+
+    // calloc fills the entries by NULLs meaning "no value"
+    Node* node = ( Node*)calloc( 1, size);
+    if ( node == NULL)
+    {
+        cerr << "ERROR: could not allocate a node of "
+             << entries_num << " entries" << endl;
+        exit( EXIT_FAILURE);
+    }
+
+    node->shift = this->level_shift[ level];
+    node->top = node->shift + this->level_bits[ level];
+    node->mask = entries_num - 1;
+    node->level = level;
+    node->prefix = key >> node->top;
+
+    // the nodes can be allocated by several threads at once
+    __atomic_fetch_add( &this->nodes_size, size, __ATOMIC_RELAXED);
+    return node;
+}
+
+void RadixTree::freeNodes( Node* node, bool keep_node)
+{
+    if ( node->shift != 0)
+    {
+        for ( uint64 i = 0; i <= node->mask; ++i)
+        {
+            if ( node->entries[ i] != NULL)
+                this->freeNodes( ( Node*)node->entries[ i], false);
+        }
+    }
+
+    if ( keep_node)
+    {
+        memset( node->entries, 0, ( node->mask + 1) * sizeof( void*));
+        return;
+    }
+
+    this->nodes_size -= sizeof( Node) + node->mask * sizeof( void*);
+    free( node);
+}
+
+void RadixTree::clear()
+{
+    this->freeNodes( this->root, true);
+}
+
+void** RadixTree::allocSlot( uint64 key, bool concurrent)
+{
+    assert( ( key >> this->key_bits) == 0);
+
+    Node* node = this->root;
+    for ( ;;)
+    {
+        void** entry = &node->entries[ ( key >> node->shift) & node->mask];
+        if ( node->shift == 0)
+            return entry;
+
+        Node* child = ( Node*)( concurrent ? __atomic_load_n( entry, __ATOMIC_ACQUIRE) : *entry);
+        Node* new_node = NULL;
+
+        if ( child == NULL)
+        {
+            // the whole path below is compressed into the last level node
+            new_node = this->allocNode( this->levels_num - 1, key);
+        } else if ( ( key >> child->top) == child->prefix)
+        {
+            node = child;
+            continue;
+        } else
+        {
+            // The key leaves the compressed path, so it is split by a node
+            // of the deepest level, where the key and the path still have
+            // the same upper bits. Their indexes in that node differ.
+            uint64 level = child->level - 1;
+            while ( ( key >> ( this->level_shift[ level] + this->level_bits[ level])) !=
+                    ( child->prefix >> ( this->level_shift[ level] + this->level_bits[ level] - child->top)))
+            {
+                --level;
+            }
+
+            new_node = this->allocNode( level, key);
+            new_node->entries[ ( child->prefix >> ( new_node->shift - child->top)) & new_node->mask] = child;
+        }
+
+        // the node is published filled, so the concurrent lookups see it whole
+        if ( !concurrent)
+        {
+            *entry = new_node;
+        } else if ( !__atomic_compare_exchange_n( entry, ( void**)&child, ( void*)new_node, false,
+                                                  __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        {
+            // another thread has changed the entry, so look at it again
+            __atomic_fetch_sub( &this->nodes_size, sizeof( Node) + new_node->mask * sizeof( void*),
+                                __ATOMIC_RELAXED);
+            free( new_node);
+        }
+    }
+}
+
+void* RadixTree::findNext( const Node* node, uint64& key) const
+{
+    uint64 key_prefix = key >> node->top;
+    if ( key_prefix > node->prefix)
+        return NULL;
+
+    uint64 base = node->prefix << node->top;
+    if ( key_prefix < node->prefix)
+        key = base;
+
+    for ( uint64 i = ( key >> node->shift) & node->mask; i <= node->mask; ++i)
+    {
+        // the keys of the previous entries are skipped
+        uint64 entry_key = base | ( i << node->shift);
+        if ( entry_key > key)
+            key = entry_key;
+
+        void* entry = node->entries[ i];
+        if ( entry == NULL)
+            continue;
+
+        if ( node->shift == 0)
+            return entry;
+
+        void* value = this->findNext( ( const Node*)entry, key);
+        if ( value != NULL)
+            return value;
+    }
+
+    return NULL;
+}
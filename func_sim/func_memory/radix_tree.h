@@ -0,0 +1,118 @@
+/**
+ * radix_tree.h - Header of the radix tree mapping sparse keys
+ * (e.g. the upper bits of guest addresses) to pointers.
+ * Copyright 2015 MIPT-MIPS iLab project
+ */
+
+// protection from multi-include
+#ifndef FUNC_MEMORY__RADIX_TREE_H
+#define FUNC_MEMORY__RADIX_TREE_H
+
+// Generic C
+#include <cstddef>
+
+// uArchSim modules
+#include <types.h>
+
+using namespace std;
+
+//
+// The key is split into levels of at most max_node_bits bits, a node
+// of a level is a table indexed by its bits. The root covers the upper
+// level and is allocated at once, so a key of max_node_bits bits or less
+// is just an index in a single table.
+//
+// The paths are compressed: a node is hung right into the first empty
+// entry on the path to it, skipping the levels between them, and keeps
+// the upper key bits it covers to be checked by the lookup. A node of
+// an intermediate level is inserted only when a new key leaves such
+// a compressed path. Thus, a few distant clusters of keys cost a few
+// nodes each, whatever the number of levels is.
+//
+// The nodes are never removed until clear(), so a node once published
+// with compare-and-swap is valid for the concurrent lookups.
+//
+class RadixTree
+{
+    struct Node
+    {
+        uint64 prefix; // the key bits above the node, i.e. key >> top
+        uint64 top;    // shift + bits
+        uint64 shift;  // position of the bits indexing the node
+        uint64 mask;   // ( 1 << bits) - 1
+        uint64 level;  // 0 for the root
+        void* entries[ 1]; // values at the last level, nodes otherwise
+    };
+
+    uint64 key_bits;
+    uint64 levels_num;
+    uint64 level_shift[ 64]; // position of the bits of the level
+    uint64 level_bits[ 64];
+
+    Node* root;
+    uint64 nodes_size; // bytes taken by all the nodes
+
+    // You could not create the object
+    // using this default constructor
+    RadixTree(){}
+    RadixTree( const RadixTree&);
+    RadixTree& operator=( const RadixTree&);
+
+    Node* allocNode( uint64 level, uint64 key);
+    void  freeNodes( Node* node, bool keep_node);
+
+    template<bool CONCURRENT>
+    inline void* findValue( uint64 key) const;
+    void** allocSlot( uint64 key, bool concurrent);
+    void*  findNext( const Node* node, uint64& key) const;
+
+public:
+    static const uint64 DEFAULT_NODE_BITS = 12;
+
+    RadixTree( uint64 key_bits, uint64 max_node_bits = DEFAULT_NODE_BITS);
+    virtual ~RadixTree();
+
+    // returns the value of the key or NULL if it is not set
+    void* find( uint64 key) const { return this->findValue<false>( key); }
+    // the same, but it can be done concurrently with slotShared()
+    void* findShared( uint64 key) const { return this->findValue<true>( key); }
+
+    // Returns the entry keeping the value of the key, the path to it
+    // is allocated if needed. The shared version installs the nodes
+    // with compare-and-swap, so it can be called by several threads.
+    void** slot( uint64 key) { return this->allocSlot( key, false); }
+    void** slotShared( uint64 key) { return this->allocSlot( key, true); }
+
+    // Looks for the first key not less than the given one having
+    // a value. Returns NULL if there is no such key, otherwise
+    // the key is set to the found one.
+    void* findNext( uint64& key) const { return this->findNext( this->root, key); }
+
+    // removes all the keys, the values are to be freed by the caller
+    void clear();
+
+    uint64 levelsNum() const { return this->levels_num; }
+    // number of bytes taken from the host by the nodes
+    uint64 footprint() const { return this->nodes_size; }
+};
+
+template<bool CONCURRENT>
+inline void* RadixTree::findValue( uint64 key) const
+{
+    const Node* node = this->root;
+    for ( ;;)
+    {
+        void* const* entry = &node->entries[ ( key >> node->shift) & node->mask];
+        void* value = CONCURRENT ? __atomic_load_n( entry, __ATOMIC_ACQUIRE) : *entry;
+
+        if ( node->shift == 0 || value == NULL)
+            return value;
+
+        // the node could be hung below a compressed path
+        node = ( const Node*)value;
+        if ( ( key >> node->top) != node->prefix)
+            return NULL;
+    }
+}
+
+#endif // #ifndef FUNC_MEMORY__RADIX_TREE_H
@@ -1,6 +1,14 @@
 // generic C
 #include <cassert>
+#include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <elf.h>
+#include <pthread.h>
+#include <unistd.h>
+
+// Generic C++
+#include <sstream>
 
 // Google Test library
 #include <gtest/gtest.h>
@@ -9,6 +17,10 @@
 #include <func_memory.h>
 
 static const char * valid_elf_file = "./mips_bin_exmpl.out";
+// The file above converted to big-endian by "make mips_bin_exmpl_eb.out":
+// el2eb.py swaps the ELF structures, the instructions and the data items
+// by their widths in tests/samples/static_arrays.s, the common source
+static const char * valid_eb_elf_file = "./mips_bin_exmpl_eb.out";
 
 //
 // Check that all incorect input params of the constructor
@@ -26,6 +38,17 @@ TEST( Func_memory_init, Process_Wrong_Args_Of_Constr)
     // must exit and return EXIT_FAILURE
     ASSERT_EXIT( FuncMemory func_mem( wrong_file_name),
                  ::testing::ExitedWithCode( EXIT_FAILURE), "ERROR.*");
+
+    // test behavior when the page number and the offset
+    // do not fit into the address
+    ASSERT_EXIT( FuncMemory func_mem( valid_elf_file, 32, 16, 20),
+                 ::testing::ExitedWithCode( EXIT_FAILURE), "ERROR.*");
+
+    // test behavior when the pages are larger than 4GB
+    ASSERT_EXIT( FuncMemory func_mem( valid_elf_file, 64, 0, 64),
+                 ::testing::ExitedWithCode( EXIT_FAILURE), "ERROR.*");
+    ASSERT_EXIT( FuncMemory func_mem( valid_elf_file, 64, 0, 33),
+                 ::testing::ExitedWithCode( EXIT_FAILURE), "ERROR.*");
 }
 
 TEST( Func_memory, StartPC_Method_Test)
@@ -113,6 +136,906 @@ TEST( Func_memory, Write_Read_Not_Initialized_Mem_Test)
     ASSERT_EQ( func_mem.read( write_addr + 2, sizeof( uint16)), right_ret);
 }
 
+TEST( Func_memory, Tlb_Statistics_Test)
+{
+    FuncMemory func_mem( valid_elf_file);
+
+    uint64 data_sect_addr = 0x4100c0;
+    uint64 hits = func_mem.tlbHits();
+    uint64 misses = func_mem.tlbMisses();
+
+    // the page of the ".data" section has been just written
+    // by the constructor, so its translation must be cached
+    func_mem.read( data_sect_addr);
+    ASSERT_EQ( func_mem.tlbHits(), hits + 1);
+    ASSERT_EQ( func_mem.tlbMisses(), misses);
+
+    // consequent accesses to the same page hit too
+    func_mem.read( data_sect_addr + 4);
+    func_mem.write( 1, data_sect_addr + 8);
+    ASSERT_EQ( func_mem.tlbHits(), hits + 3);
+    ASSERT_EQ( func_mem.tlbMisses(), misses);
+}
+
+TEST( Func_memory, Typed_Access_Test)
+{
+    FuncMemory func_mem( valid_elf_file);
+
+    uint64 data_sect_addr = 0x4100c0;
+
+    ASSERT_EQ( func_mem.read<uint8>( data_sect_addr + 3), 0x03);
+    ASSERT_EQ( func_mem.read<uint16>( data_sect_addr + 2), 0x0302);
+    ASSERT_EQ( func_mem.read<uint32>( data_sect_addr), 0x03020100u);
+    ASSERT_EQ( func_mem.read<uint64>( data_sect_addr), 0x0706050403020100ull);
+
+    // the typed and the generic accesses must agree with each other
+    func_mem.write<uint32>( 0xdeadbeef, data_sect_addr + 1);
+    ASSERT_EQ( func_mem.read( data_sect_addr + 1, 3), 0xadbeefu);
+    ASSERT_EQ( func_mem.read<uint16>( data_sect_addr + 3), 0xdeadu);
+
+    // write crossing the page boundary
+    uint64 write_addr = 0x3FFFFC;
+    func_mem.write<uint64>( 0x0123456789abcdefull, write_addr);
+    ASSERT_EQ( func_mem.read<uint64>( write_addr), 0x0123456789abcdefull);
+    ASSERT_EQ( func_mem.read<uint32>( write_addr + 2), 0x456789abu);
+}
+
+TEST( Func_memory, Block_Access_Test)
+{
+    FuncMemory func_mem( valid_elf_file);
+
+    // the block crosses two page boundaries
+    uint64 block_addr = 0x500ff0;
+    const uint64 block_size = 0x1020;
+
+    uint8 src[ block_size];
+    for ( uint64 i = 0; i < block_size; ++i)
+        src[ i] = ( uint8)( i * 7 + 1);
+
+    func_mem.writeBlock( src, block_addr, block_size);
+
+    uint8 dst[ block_size];
+    func_mem.readBlock( block_addr, dst, block_size);
+    ASSERT_EQ( memcmp( src, dst, block_size), 0);
+    ASSERT_EQ( func_mem.read<uint8>( block_addr + 0x10), src[ 0x10]);
+
+    // fill the middle of the block
+    func_mem.fill( 0xab, block_addr + 8, 0x1000);
+    ASSERT_EQ( func_mem.read<uint32>( block_addr + 8), 0xababababu);
+    ASSERT_EQ( func_mem.read<uint32>( block_addr + 0x1004), 0xababababu);
+    ASSERT_EQ( func_mem.read<uint8>( block_addr + 0x1008), src[ 0x1008]);
+
+    // overlapping copies in both directions must work as memmove
+    func_mem.writeBlock( src, block_addr, block_size);
+    func_mem.copyWithin( block_addr + 3, block_addr, block_size - 3);
+    func_mem.readBlock( block_addr + 3, dst, block_size - 3);
+    ASSERT_EQ( memcmp( src, dst, block_size - 3), 0);
+
+    func_mem.writeBlock( src, block_addr, block_size);
+    func_mem.copyWithin( block_addr, block_addr + 5, block_size - 5);
+    func_mem.readBlock( block_addr, dst, block_size - 5);
+    ASSERT_EQ( memcmp( src + 5, dst, block_size - 5), 0);
+
+    // reading of not initialized data must be caught
+    ASSERT_EXIT( func_mem.readBlock( 0x300000, dst, 4),
+                 ::testing::KilledBySignal( SIGABRT), ".*");
+}
+
+TEST( Func_memory, Flat_Mapping_Backend_Test)
+{
+    FuncMemory func_mem( valid_elf_file, 32, 10, 12, FuncMemory::FLAT_MAPPING);
+
+    ASSERT_EQ( func_mem.startPC(), 0x4000b0);
+    ASSERT_EQ( func_mem.read( 0x4100c0), 0x03020100u);
+
+    // write crossing the page boundary
+    uint64 write_addr = 0x3FFFFE;
+    func_mem.write( 0x03020100, write_addr, sizeof( uint32));
+    ASSERT_EQ( func_mem.read( write_addr + 1, sizeof( uint16)), 0x0201u);
+
+    // the flat mapping still tracks the written pages
+    ASSERT_EXIT( func_mem.read( 0x300000),
+                 ::testing::KilledBySignal( SIGABRT), ".*");
+
+    // and the pages written since the last checkpoint
+    const char* checkpoint_file = "./checkpoint_flat.tmp";
+    func_mem.saveCheckpoint( checkpoint_file);
+    ASSERT_EQ( func_mem.dirtyPagesNum(), 0u);
+    func_mem.write( 0x55, 0x4100c8, 1);
+    func_mem.write( 0x55, 0x4100cc, 1);
+    func_mem.write( 0x55, 0x3FFFFE, sizeof( uint32));
+    ASSERT_EQ( func_mem.dirtyPagesNum(), 3u);
+    func_mem.saveCheckpoint( checkpoint_file);
+    ASSERT_EQ( func_mem.dirtyPagesNum(), 0u);
+    remove( checkpoint_file);
+
+    // the flat mapping is supported only for 32-bit addresses
+    ASSERT_EXIT( FuncMemory func_mem( valid_elf_file, 64, 15, 32, FuncMemory::FLAT_MAPPING),
+                 ::testing::ExitedWithCode( EXIT_FAILURE), "ERROR.*");
+}
+
+TEST( Func_memory, Snapshot_Restore_Test)
+{
+    FuncMemory func_mem( valid_elf_file);
+
+    uint64 data_sect_addr = 0x4100c0;
+    uint64 new_page_addr = 0x500000;
+
+    FuncMemory::Snapshot* snapshot = func_mem.snapshot();
+
+    // the writes after the snapshot must not affect it
+    func_mem.write( 0xdeadbeef, data_sect_addr);
+    func_mem.write( 0x12345678, new_page_addr);
+    ASSERT_EQ( func_mem.read( data_sect_addr), 0xdeadbeefu);
+    ASSERT_EQ( func_mem.read( new_page_addr), 0x12345678u);
+
+    func_mem.restore( *snapshot);
+    ASSERT_EQ( func_mem.read( data_sect_addr), 0x03020100u);
+    ASSERT_EXIT( func_mem.read( new_page_addr),
+                 ::testing::KilledBySignal( SIGABRT), ".*");
+
+    // the snapshot can be restored many times
+    func_mem.write( 0x1, data_sect_addr, sizeof( uint8));
+    func_mem.restore( *snapshot);
+    ASSERT_EQ( func_mem.read( data_sect_addr), 0x03020100u);
+
+    // the restored state does not depend on the snapshot lifetime
+    delete snapshot;
+    ASSERT_EQ( func_mem.read( data_sect_addr + 4), 0x07060504u);
+    func_mem.write( 0x0, data_sect_addr);
+    ASSERT_EQ( func_mem.read( data_sect_addr), 0x0u);
+}
+
+TEST( Func_memory, Incremental_Checkpoint_Test)
+{
+    FuncMemory func_mem( valid_elf_file);
+
+    const char* base_file = "./checkpoint_base.tmp";
+    const char* delta_file = "./checkpoint_delta.tmp";
+
+    // the first checkpoint saves all the pages
+    ASSERT_GT( func_mem.dirtyPagesNum(), 0u);
+    func_mem.saveCheckpoint( base_file);
+    ASSERT_EQ( func_mem.dirtyPagesNum(), 0u);
+
+    // the next one saves only the written pages
+    func_mem.write( 0xdeadbeef, 0x4100c0);
+    func_mem.write( 0xdeadbeef, 0x4100c4);
+    func_mem.write( 0x12345678, 0x500000);
+    ASSERT_EQ( func_mem.dirtyPagesNum(), 2u);
+    func_mem.saveCheckpoint( delta_file);
+    ASSERT_EQ( func_mem.dirtyPagesNum(), 0u);
+
+    vector<string> chain;
+    chain.push_back( base_file);
+
+    FuncMemory base_mem( chain);
+    ASSERT_EQ( base_mem.startPC(), func_mem.startPC());
+    ASSERT_EQ( base_mem.read( 0x4100c0), 0x03020100u);
+    ASSERT_EXIT( base_mem.read( 0x500000),
+                 ::testing::KilledBySignal( SIGABRT), ".*");
+
+    chain.push_back( delta_file);
+
+    FuncMemory delta_mem( chain, FuncMemory::FLAT_MAPPING);
+    ASSERT_EQ( delta_mem.dump(), func_mem.dump());
+    ASSERT_EQ( delta_mem.dirtyPagesNum(), 0u);
+
+    // a write after a read of the page is saved too
+    const char* read_write_file = "./checkpoint_read_write.tmp";
+    ASSERT_EQ( func_mem.read( 0x4100c8, 1), 0x08u);
+    func_mem.write( 0x55, 0x4100c8, 1);
+    ASSERT_EQ( func_mem.dirtyPagesNum(), 1u);
+    func_mem.saveCheckpoint( read_write_file);
+
+    chain.push_back( read_write_file);
+    FuncMemory read_write_mem( chain);
+    ASSERT_EQ( read_write_mem.read( 0x4100c8, 1), 0x55u);
+
+    remove( base_file);
+    remove( delta_file);
+    remove( read_write_file);
+}
+
+TEST( Func_memory, Compact_Checkpoint_Test)
+{
+    FuncMemory func_mem( valid_elf_file);
+    func_mem.fill( 0x5a, 0x600000, 0x10000);
+
+    // a page of bytes without runs is saved as is
+    for ( uint64 i = 0; i < 0x1000; i += 4)
+        func_mem.write( ( uint32)( i * 2654435761u), 0x700000 + i);
+
+    const char* file_name = "./checkpoint_compact.tmp";
+    func_mem.saveCheckpoint( file_name);
+
+    FILE* file = fopen( file_name, "rb");
+    ASSERT_TRUE( file != NULL);
+    fseek( file, 0, SEEK_END);
+    long size = ftell( file);
+    fclose( file);
+
+    // the runs take a few bytes per page
+    ASSERT_GT( size, 0x1000);
+    ASSERT_LT( size, 0x2000);
+
+    vector<string> chain( 1, file_name);
+    FuncMemory loaded_mem( chain);
+    ASSERT_EQ( loaded_mem.dump(), func_mem.dump());
+    ASSERT_EQ( loaded_mem.startPC(), func_mem.startPC());
+
+    // a truncated checkpoint is reported
+    ASSERT_EQ( truncate( file_name, size - 1), 0);
+    ASSERT_EXIT( FuncMemory truncated_mem( chain),
+                 ::testing::ExitedWithCode( EXIT_FAILURE), "ERROR.*");
+
+    remove( file_name);
+}
+
+TEST( Func_memory, Page_Arena_Test)
+{
+    PageArena arena( 4096, 4 * 4096);
+
+    uint8* first = arena.allocate();
+    uint8* second = arena.allocate();
+
+    // blocks are aligned and zeroed
+    ASSERT_EQ( ( uint64)first % 4096, 0u);
+    ASSERT_EQ( ( uint64)second % 4096, 0u);
+    ASSERT_EQ( first[ 100], 0);
+
+    // a released block is reused and zeroed again
+    first[ 100] = 1;
+    arena.release( first);
+    ASSERT_EQ( arena.allocate(), first);
+    ASSERT_EQ( first[ 100], 0);
+
+    // new chunks are taken only when the previous one is exhausted
+    ASSERT_EQ( arena.footprint(), 4 * 4096u);
+    for ( int i = 0; i < 3; ++i)
+        arena.allocate();
+    ASSERT_EQ( arena.footprint(), 8 * 4096u);
+    ASSERT_EQ( arena.peakUsage(), 5 * 4096u);
+
+    FuncMemory func_mem( valid_elf_file);
+    ASSERT_GE( func_mem.arenaPeakFootprint(), 2 * 4096u);
+
+    // chunks backed by huge pages consist of whole huge pages
+    PageArena huge_arena( 4096, 4 * 4096, true);
+    uint8* block = huge_arena.allocate();
+    ASSERT_EQ( block[ 0], 0);
+    ASSERT_EQ( huge_arena.footprint(), PageArena::HUGE_PAGE_SIZE);
+    if ( huge_arena.hugePages() == PageArena::HUGE_PAGES_TRANSPARENT)
+    {
+        ASSERT_EQ( ( uint64)block % PageArena::HUGE_PAGE_SIZE, 0u);
+    }
+
+    FuncMemory huge_mem( valid_elf_file, 32, 10, 12, FuncMemory::PAGE_TABLE, true);
+    ASSERT_EQ( huge_mem.read( 0x4100c0), 0x03020100u);
+}
+
+TEST( Func_memory, Radix_Tree_Test)
+{
+    RadixTree tree( 42);
+    ASSERT_EQ( tree.levelsNum(), 4u);
+
+    int values[ 4];
+    uint64 keys[ 4] = { 0x1, 0x401, 0x12345678, 0x3ffffffffffull };
+
+    // the keys of distant clusters hang below the root directly
+    uint64 root_size = tree.footprint();
+    *tree.slot( keys[ 0]) = &values[ 0];
+    *tree.slot( keys[ 3]) = &values[ 3];
+    ASSERT_LT( tree.footprint(), 3 * root_size);
+
+    // a key leaving a compressed path splits it
+    *tree.slot( keys[ 1]) = &values[ 1];
+    *tree.slotShared( keys[ 2]) = &values[ 2];
+
+    for ( int i = 0; i < 4; ++i)
+    {
+        ASSERT_EQ( tree.find( keys[ i]), &values[ i]);
+        ASSERT_EQ( tree.findShared( keys[ i]), &values[ i]);
+    }
+    ASSERT_EQ( tree.find( 0x2), ( void*)NULL);
+    ASSERT_EQ( tree.find( 0x1000001), ( void*)NULL);
+
+    // the keys are visited in the ascending order
+    uint64 key = 0;
+    for ( int i = 0; i < 4; ++i, ++key)
+    {
+        ASSERT_EQ( tree.findNext( key), &values[ i]);
+        ASSERT_EQ( key, keys[ i]);
+    }
+    ASSERT_EQ( tree.findNext( key), ( void*)NULL);
+
+    tree.clear();
+    ASSERT_EQ( tree.find( keys[ 0]), ( void*)NULL);
+    ASSERT_EQ( tree.footprint(), root_size);
+}
+
+TEST( Func_memory, Wide_Address_Space_Test)
+{
+    FuncMemory func_mem( valid_elf_file, 64, 10, 12);
+    ASSERT_EQ( func_mem.read( 0x4100c0), 0x03020100u);
+
+    uint64 addrs[ 3] = { 0x7fffffffe000ull, 0x123456789abcull, 0xfffffffffffff000ull };
+    for ( int i = 0; i < 3; ++i)
+        func_mem.write<uint64>( addrs[ i] + i, addrs[ i]);
+    for ( int i = 0; i < 3; ++i)
+        ASSERT_EQ( func_mem.read<uint64>( addrs[ i]), addrs[ i] + i);
+
+    // the snapshots and the dump walk the sparse set table
+    FuncMemory::Snapshot* snapshot = func_mem.snapshot();
+    func_mem.write<uint64>( 0, addrs[ 2]);
+    func_mem.restore( *snapshot);
+    delete snapshot;
+    ASSERT_EQ( func_mem.read<uint64>( addrs[ 2]), addrs[ 2] + 2);
+
+    ostringstream dump;
+    func_mem.dump( dump, "", addrs[ 2], MAX_VAL64);
+    ASSERT_NE( dump.str().find( "0xfffffffffffff000:"), string::npos);
+
+    // the pages smaller than a word are allowed too
+    FuncMemory tiny_mem( valid_elf_file, 32, 10, 2);
+    ASSERT_EQ( tiny_mem.read( 0x4100c2, 4), func_mem.read( 0x4100c2, 4));
+}
+
+TEST( Func_memory, Zero_Page_Test)
+{
+    FuncMemory func_mem( valid_elf_file);
+
+    // 4 MB of zeros must not take any host memory
+    uint64 zero_addr = 0x10000000;
+    uint64 zero_size = 4 * 1024 * 1024;
+    uint64 footprint = func_mem.arenaPeakFootprint();
+    func_mem.fill( 0, zero_addr, zero_size);
+    ASSERT_EQ( func_mem.arenaPeakFootprint(), footprint);
+    ASSERT_EQ( func_mem.read( zero_addr + 0x1234), 0u);
+
+    // a write makes a private copy of the page
+    func_mem.write( 0xdeadbeef, zero_addr + 0x1234);
+    ASSERT_EQ( func_mem.read( zero_addr + 0x1234), 0xdeadbeefu);
+    ASSERT_EQ( func_mem.read( zero_addr + 0x1230), 0u);
+    ASSERT_EQ( func_mem.read( zero_addr + 0x2234), 0u);
+
+    // the private page can be zeroed back
+    func_mem.fill( 0, zero_addr, 0x2000);
+    ASSERT_EQ( func_mem.read( zero_addr + 0x1234), 0u);
+
+    // the same for the flat mapping
+    FuncMemory flat_mem( valid_elf_file, 32, 10, 12, FuncMemory::FLAT_MAPPING);
+    flat_mem.write( 0xdeadbeef, zero_addr + 0x1234);
+    flat_mem.fill( 0, zero_addr, zero_size);
+    ASSERT_EQ( flat_mem.read( zero_addr + 0x1234), 0u);
+}
+
+TEST( Func_memory, Segment_Loading_Test)
+{
+    FuncMemory section_mem( valid_elf_file);
+    FuncMemory segment_mem( valid_elf_file, 32, 10, 12, FuncMemory::PAGE_TABLE,
+                            false, true, true);
+
+    // the execution starts from the entry point being the start of ".text"
+    ASSERT_EQ( segment_mem.startPC(), section_mem.startPC());
+    ASSERT_EQ( segment_mem.read( 0x4000b0), section_mem.read( 0x4000b0));
+    ASSERT_EQ( segment_mem.read( 0x4100c2, 4), section_mem.read( 0x4100c2, 4));
+    ASSERT_EXIT( segment_mem.write( 0, 0x4000b0),
+                 ::testing::ExitedWithCode( EXIT_FAILURE), "ERROR.*");
+
+    // a little-endian ELF having a segment of 16 bytes followed by 64 MB of zeros
+    const uint64 bss_size = 64 * 1024 * 1024;
+    Elf32_Ehdr ehdr;
+    memset( &ehdr, 0, sizeof( ehdr));
+    memcpy( ehdr.e_ident, ELFMAG, SELFMAG);
+    ehdr.e_ident[ EI_CLASS] = ELFCLASS32;
+    ehdr.e_ident[ EI_DATA] = ELFDATA2LSB;
+    ehdr.e_ident[ EI_VERSION] = EV_CURRENT;
+    ehdr.e_type = ET_EXEC;
+    ehdr.e_machine = EM_MIPS;
+    ehdr.e_version = EV_CURRENT;
+    ehdr.e_entry = 0x10000000;
+    ehdr.e_phoff = sizeof( ehdr);
+    ehdr.e_ehsize = sizeof( ehdr);
+    ehdr.e_phentsize = sizeof( Elf32_Phdr);
+    ehdr.e_phnum = 1;
+
+    Elf32_Phdr phdr;
+    memset( &phdr, 0, sizeof( phdr));
+    phdr.p_type = PT_LOAD;
+    phdr.p_offset = sizeof( ehdr) + sizeof( phdr);
+    phdr.p_vaddr = 0x10000000;
+    phdr.p_filesz = 16;
+    phdr.p_memsz = 16 + bss_size;
+    phdr.p_flags = PF_R | PF_W;
+
+    const char* bss_file = "./bss_segment.tmp";
+    FILE* file = fopen( bss_file, "wb");
+    ASSERT_TRUE( file != NULL);
+    fwrite( &ehdr, sizeof( ehdr), 1, file);
+    fwrite( &phdr, sizeof( phdr), 1, file);
+    for ( uint32 i = 0; i < 16; ++i)
+        fputc( 0x11 * i, file);
+    fclose( file);
+
+    FuncMemory bss_mem( bss_file, 32, 10, 12, FuncMemory::PAGE_TABLE, false, false, true);
+    ASSERT_EQ( bss_mem.startPC(), 0x10000000u);
+    ASSERT_EQ( bss_mem.read( 0x1000000c), 0xffeeddccu);
+
+    // the zeros take no host memory until they are written
+    ASSERT_LT( bss_mem.arenaPeakFootprint(), bss_size / 4);
+    ASSERT_EQ( bss_mem.read( 0x10000010), 0u);
+    ASSERT_EQ( bss_mem.read( 0x10000000 + bss_size + 12), 0u);
+
+    bss_mem.write( 0xdeadbeef, 0x10080000);
+    ASSERT_EQ( bss_mem.read( 0x10080000), 0xdeadbeefu);
+    ASSERT_EQ( bss_mem.read( 0x10081000), 0u);
+
+    // the protected zeros are shared as well
+    FuncMemory protected_mem( bss_file, 32, 10, 12, FuncMemory::PAGE_TABLE, false, true, true);
+    uint64 footprint = protected_mem.arenaPeakFootprint();
+    ASSERT_LT( footprint, bss_size / 4);
+    ASSERT_EQ( protected_mem.permissions( 0x10080000),
+               ( uint32)( FuncMemory::PERM_READ | FuncMemory::PERM_WRITE));
+    ASSERT_EQ( protected_mem.read( 0x10080000), 0u);
+    ASSERT_EXIT( protected_mem.fetch( 0x10080000),
+                 ::testing::ExitedWithCode( EXIT_FAILURE), "ERROR.*");
+
+    // a written page is copied with the permissions of the zeros
+    protected_mem.write( 0xdeadbeef, 0x10080000);
+    ASSERT_EQ( protected_mem.read( 0x10080000), 0xdeadbeefu);
+    ASSERT_EQ( protected_mem.permissions( 0x10080000),
+               ( uint32)( FuncMemory::PERM_READ | FuncMemory::PERM_WRITE));
+    protected_mem.setPermissions( 0x10100000, 0x100000, FuncMemory::PERM_READ);
+    ASSERT_EQ( protected_mem.arenaPeakFootprint(), footprint);
+    ASSERT_EXIT( protected_mem.write( 1, 0x10100000),
+                 ::testing::ExitedWithCode( EXIT_FAILURE), "ERROR.*");
+
+    remove( bss_file);
+}
+
+TEST( Func_memory, Byte_Order_Test)
+{
+    FuncMemory el_mem( valid_elf_file);
+    FuncMemory eb_mem( valid_eb_elf_file);
+
+    ASSERT_EQ( el_mem.byteOrder(), LITTLE_ENDIAN_ORDER);
+    ASSERT_EQ( eb_mem.byteOrder(), BIG_ENDIAN_ORDER);
+    ASSERT_EQ( eb_mem.startPC(), el_mem.startPC());
+
+    // ".data" starts from bytes 0, 1, 2 ... and then has words 7, 11, 13
+    uint64 bytes_addr = 0x4100c0;
+    uint64 words_addr = 0x4100cc;
+
+    ASSERT_EQ( el_mem.read( bytes_addr), 0x03020100u);
+    ASSERT_EQ( eb_mem.read( bytes_addr), 0x00010203u);
+    ASSERT_EQ( eb_mem.read( bytes_addr + 1, 3), 0x010203u);
+    ASSERT_EQ( eb_mem.read<uint16>( bytes_addr + 2), 0x0203u);
+
+    ASSERT_EQ( el_mem.read<uint32>( words_addr + 4), 11u);
+    ASSERT_EQ( eb_mem.read( words_addr), 7u);
+    ASSERT_EQ( eb_mem.read<uint32>( words_addr + 4), 11u);
+    ASSERT_EQ( eb_mem.read( words_addr + 8), 13u);
+    ASSERT_EQ( eb_mem.read<uint8>( words_addr + 3), 7u);
+
+    // the instructions are the same, "lui $t3, 0x41" is the first one
+    ASSERT_EQ( eb_mem.fetch( eb_mem.startPC()), 0x3c0b0041u);
+    ASSERT_EQ( eb_mem.fetch( eb_mem.startPC() + 8), el_mem.fetch( el_mem.startPC() + 8));
+
+    // the byte order can be chosen at compile time
+    ASSERT_EQ( ( el_mem.read<uint32, BIG_ENDIAN_ORDER>( bytes_addr)), 0x00010203u);
+    ASSERT_EQ( ( eb_mem.read<uint32, LITTLE_ENDIAN_ORDER>( bytes_addr)), 0x03020100u);
+
+    // the writes in the big-endian order, including the page crossing ones
+    eb_mem.write( 0x11223344, words_addr);
+    ASSERT_EQ( eb_mem.read<uint8>( words_addr), 0x11u);
+    eb_mem.write( 0x0102030405ull, 0x3FFFFE, 5);
+    ASSERT_EQ( eb_mem.read<uint8>( 0x3FFFFE), 0x01u);
+    ASSERT_EQ( eb_mem.read<uint16>( 0x3FFFFF), 0x0203u);
+    ASSERT_EQ( eb_mem.read( 0x3FFFFE, 5), 0x0102030405ull);
+}
+
+TEST( Func_memory, Not_Initialized_Bytes_Test)
+{
+    FuncMemory func_mem( valid_elf_file);
+
+    // a page is allocated by a write, but only the written bytes can be read
+    func_mem.write( 0xab, 0x500001, sizeof( uint8));
+    ASSERT_EQ( func_mem.read( 0x500001, sizeof( uint8)), 0xabu);
+
+    // the write crossing the page boundary marks the bytes of both pages
+    func_mem.write( 0x1234, 0x5FFFFF, sizeof( uint16));
+    ASSERT_EQ( func_mem.read( 0x5FFFFF, sizeof( uint16)), 0x1234u);
+
+    // a page filled entirely drops the bitmap
+    func_mem.fill( 0x5a, 0x700000, 0x1000);
+    ASSERT_EQ( func_mem.read<uint64>( 0x700ff8), 0x5a5a5a5a5a5a5a5aull);
+
+    // the bitmap is preserved by snapshots and checkpoints
+    FuncMemory::Snapshot* snapshot = func_mem.snapshot();
+    func_mem.write( 0xcd, 0x500002, sizeof( uint8));
+    ASSERT_EQ( func_mem.read( 0x500001, sizeof( uint16)), 0xcdabu);
+    func_mem.restore( *snapshot);
+    delete snapshot;
+
+    const char* checkpoint_file = "./checkpoint_shadow.tmp";
+    func_mem.saveCheckpoint( checkpoint_file);
+    vector<string> chain( 1, checkpoint_file);
+    FuncMemory loaded_mem( chain, FuncMemory::FLAT_MAPPING);
+    remove( checkpoint_file);
+
+    ASSERT_EQ( loaded_mem.read( 0x500001, sizeof( uint8)), 0xabu);
+    ASSERT_EQ( loaded_mem.read( 0x700000), 0x5a5a5a5au);
+
+    if ( !FUNC_MEMORY_INIT_CHECK)
+        return;
+
+    uint8 block[ 4];
+    ASSERT_EXIT( func_mem.read( 0x500000, sizeof( uint8)),
+                 ::testing::KilledBySignal( SIGABRT), ".*");
+    ASSERT_EXIT( func_mem.read( 0x500001, sizeof( uint16)),
+                 ::testing::KilledBySignal( SIGABRT), ".*");
+    ASSERT_EXIT( func_mem.read( 0x5FFFFF, 3),
+                 ::testing::KilledBySignal( SIGABRT), ".*");
+    ASSERT_EXIT( func_mem.read<uint32>( 0x5FFFFE),
+                 ::testing::KilledBySignal( SIGABRT), ".*");
+    ASSERT_EXIT( func_mem.readBlock( 0x4FFFFF, block, 4),
+                 ::testing::KilledBySignal( SIGABRT), ".*");
+    ASSERT_EXIT( loaded_mem.read( 0x500002, sizeof( uint8)),
+                 ::testing::KilledBySignal( SIGABRT), ".*");
+}
+
+TEST( Func_memory, Image_Test)
+{
+    FuncMemory func_mem( valid_elf_file);
+    func_mem.write( 0xdeadbeef, 0x500000);
+    func_mem.fill( 0x5a, 0x700000, 0x3000);
+
+    const char* image_file = "./memory_image.tmp";
+    func_mem.saveImage( image_file);
+
+    FuncMemory image_mem( FuncMemory::IMAGE, image_file);
+    ASSERT_EQ( image_mem.dump(), func_mem.dump());
+    ASSERT_EQ( image_mem.startPC(), func_mem.startPC());
+    ASSERT_EQ( image_mem.read( 0x4100c0), 0x03020100u);
+    ASSERT_EQ( image_mem.read( 0x500000), 0xdeadbeefu);
+
+    // the writes are private, so the image can be opened again
+    image_mem.write( 0x12345678, 0x500000);
+    image_mem.write( 0x12345678, 0x701000);
+    image_mem.write( 0x1, 0x800000);
+    ASSERT_EQ( image_mem.read( 0x500000), 0x12345678u);
+
+    FuncMemory flat_mem( FuncMemory::IMAGE, image_file, FuncMemory::FLAT_MAPPING);
+    ASSERT_EQ( flat_mem.dump(), func_mem.dump());
+    flat_mem.write( 0x12345678, 0x701000);
+    ASSERT_EQ( flat_mem.read( 0x701000), 0x12345678u);
+    ASSERT_EQ( flat_mem.read( 0x702000), 0x5a5a5a5au);
+
+    FuncMemory reopened_mem( FuncMemory::IMAGE, image_file);
+    ASSERT_EQ( reopened_mem.read( 0x500000), 0xdeadbeefu);
+    ASSERT_EQ( reopened_mem.read( 0x701000), 0x5a5a5a5au);
+    if ( FUNC_MEMORY_INIT_CHECK)
+    {
+        ASSERT_EXIT( reopened_mem.read( 0x500004),
+                     ::testing::KilledBySignal( SIGABRT), ".*");
+    }
+
+    // pages smaller than the host ones are copied into the flat mapping
+    FuncMemory small_mem( valid_elf_file, 32, 16, 8);
+    small_mem.saveImage( image_file);
+    FuncMemory small_flat_mem( FuncMemory::IMAGE, image_file, FuncMemory::FLAT_MAPPING);
+    ASSERT_EQ( small_flat_mem.dump(), small_mem.dump());
+
+    remove( image_file);
+
+    ASSERT_EXIT( FuncMemory wrong_mem( FuncMemory::IMAGE, valid_elf_file),
+                 ::testing::ExitedWithCode( EXIT_FAILURE), "ERROR.*");
+}
+
+TEST( Func_memory, Stream_Dump_Test)
+{
+    FuncMemory func_mem( valid_elf_file);
+    func_mem.fill( 0, 0x600000, 0x3000);
+    func_mem.write( 0x77, 0x601004, sizeof( uint8));
+
+    // the string dump is the streamed one
+    ostringstream full;
+    func_mem.dump( full, "  ");
+    ASSERT_EQ( full.str(), func_mem.dump( "  "));
+
+    // only the words of the range are printed, the zero runs are skipped
+    ostringstream part;
+    func_mem.dump( part, "", 0x4100c6, 0x4100d0);
+    ASSERT_EQ( part.str(), "Dump of the functional memory\n"
+                           "  addr_size = 32 bits\n"
+                           "  page_num_size = 10 bits\n"
+                           "  offset_size = 12 bits\n"
+                           "  Content:\n"
+                           "    0x4100c4:    04050607\n"
+                           "    0x4100c8:    08090000\n"
+                           "    0x4100cc:    07000000\n");
+
+    ostringstream zeros;
+    func_mem.dump( zeros, "", 0x600000, 0x603000);
+    ASSERT_NE( zeros.str().find( "  ....  \n"
+                                 "    0x601004:    77000000\n"
+                                 "  ....  \n"), string::npos);
+}
+
+TEST( Func_memory, Heat_Map_Test)
+{
+    FuncMemory func_mem( valid_elf_file);
+
+    // the loading of the ELF file is not counted
+    ostringstream empty;
+    func_mem.dumpHeatMap( empty);
+    ASSERT_EQ( empty.str(), "page,reads,writes,fetches,total\n");
+
+    func_mem.fetch( func_mem.startPC());
+    func_mem.read( 0x4100c0);
+    func_mem.read<uint16>( 0x4100c4);
+    func_mem.write( 1, 0x4100c8);
+    func_mem.fill( 0, 0x600000, 0x2000);
+
+    ostringstream heat_map;
+    func_mem.dumpHeatMap( heat_map);
+
+    if ( !FUNC_MEMORY_HEAT_COUNT)
+    {
+        ASSERT_EQ( heat_map.str(), empty.str());
+        return;
+    }
+
+    // the hottest pages go first
+    ostringstream expected;
+    expected << "page,reads,writes,fetches,total\n"
+             << "0x410000,2,1,0,3\n"
+             << "0x" << hex << ( func_mem.startPC() & ~0xfffull) << dec << ",0,0,1,1\n"
+             << "0x600000,0,1,0,1\n"
+             << "0x601000,0,1,0,1\n";
+    ASSERT_EQ( heat_map.str(), expected.str());
+
+    ostringstream hot_pages;
+    func_mem.dumpHotPages( hot_pages, 1);
+    ASSERT_EQ( hot_pages.str(), "Hottest pages of the functional memory, 6 accesses to 4 pages:\n"
+                                "  0x410000: 3 accesses (50%), 2 reads, 1 writes, 0 fetches\n");
+
+    func_mem.clearHeatMap();
+    ostringstream cleared;
+    func_mem.dumpHeatMap( cleared);
+    ASSERT_EQ( cleared.str(), empty.str());
+}
+
+TEST( Func_memory, Permissions_Test)
+{
+    FuncMemory::Backend backends[] = { FuncMemory::PAGE_TABLE, FuncMemory::FLAT_MAPPING };
+
+    for ( size_t i = 0; i < sizeof( backends) / sizeof( backends[ 0]); ++i)
+    {
+        FuncMemory func_mem( valid_elf_file, 32, 10, 12, backends[ i], false, true);
+
+        // the pages take the permissions of their sections
+        ASSERT_EQ( func_mem.permissions( 0x4000b0),
+                   ( uint32)( FuncMemory::PERM_READ | FuncMemory::PERM_EXEC));
+        ASSERT_EQ( func_mem.permissions( 0x4100c0),
+                   ( uint32)( FuncMemory::PERM_READ | FuncMemory::PERM_WRITE));
+        ASSERT_EQ( func_mem.permissions( 0x500000), ( uint32)FuncMemory::PERM_ALL);
+
+        ASSERT_EQ( func_mem.fetch( 0x4000b0), func_mem.read( 0x4000b0));
+        func_mem.write( 1, 0x4100c8);
+        func_mem.write( 1, 0x500000);
+        func_mem.fetch( 0x500000);
+
+        ASSERT_EXIT( func_mem.write( 1, 0x4000b0),
+                     ::testing::ExitedWithCode( EXIT_FAILURE), "ERROR.*");
+        ASSERT_EXIT( func_mem.fill( 0, 0x400000, 0x1000),
+                     ::testing::ExitedWithCode( EXIT_FAILURE), "ERROR.*");
+        ASSERT_EXIT( func_mem.fetch( 0x4100c0),
+                     ::testing::ExitedWithCode( EXIT_FAILURE), "ERROR.*");
+
+        // the permissions are changed page by page
+        func_mem.setPermissions( 0x4100c0, 4, FuncMemory::PERM_READ);
+        ASSERT_EQ( func_mem.read( 0x4100c8), 1u);
+        ASSERT_EXIT( func_mem.write( 2, 0x410000),
+                     ::testing::ExitedWithCode( EXIT_FAILURE), "ERROR.*");
+    }
+
+    // the permissions are a part of the saved state
+    FuncMemory func_mem( valid_elf_file, 32, 10, 12, FuncMemory::PAGE_TABLE, false, true);
+    FuncMemory::Snapshot* snapshot = func_mem.snapshot();
+    func_mem.setPermissions( 0x4000b0, 4, FuncMemory::PERM_ALL);
+    func_mem.write( 1, 0x4000b0);
+    func_mem.restore( *snapshot);
+    delete snapshot;
+    ASSERT_EXIT( func_mem.write( 1, 0x4000b0),
+                 ::testing::ExitedWithCode( EXIT_FAILURE), "ERROR.*");
+
+    const char* image_file = "./perms_test.img";
+    func_mem.saveImage( image_file);
+    FuncMemory image_mem( FuncMemory::IMAGE, image_file);
+    remove( image_file);
+    ASSERT_EQ( image_mem.permissions( 0x4000b0), func_mem.permissions( 0x4000b0));
+    ASSERT_EXIT( image_mem.fetch( 0x4100c0),
+                 ::testing::ExitedWithCode( EXIT_FAILURE), "ERROR.*");
+}
+
+struct WatchHits
+{
+    FuncMemory* memory;
+    uint64 reads;
+    uint64 writes;
+    uint64 last_addr;
+    uint64 last_size;
+};
+
+static void countWatchHit( uint64 addr, uint64 size, bool is_write, void* context)
+{
+    WatchHits* hits = ( WatchHits*)context;
+    ++( is_write ? hits->writes : hits->reads);
+    hits->last_addr = addr;
+    hits->last_size = size;
+
+    // the accesses of the callback itself are not watched
+    hits->memory->read( 0x4100c0);
+}
+
+TEST( Func_memory, Watchpoint_Test)
+{
+    FuncMemory func_mem( valid_elf_file);
+    WatchHits hits = { &func_mem, 0, 0, 0, 0};
+
+    func_mem.addWatchpoint( 0x4100cc, 4, FuncMemory::WATCH_WRITE, countWatchHit, &hits);
+
+    // the accesses outside the range do not call the callback
+    func_mem.write( 0x1, 0x4100c0);
+    func_mem.write( 0x1, 0x4100d0);
+    func_mem.read( 0x4100cc);
+    func_mem.write( 0x1, 0x500000);
+    ASSERT_EQ( hits.writes, 0u);
+    ASSERT_EQ( hits.reads, 0u);
+
+    // the watched page is not cached, so each write is caught
+    func_mem.write( 0x2, 0x4100cc);
+    func_mem.write( 0x3, 0x4100cc);
+    ASSERT_EQ( hits.writes, 2u);
+    func_mem.write<uint16>( 0x4, 0x4100cb);
+    ASSERT_EQ( hits.writes, 3u);
+    ASSERT_EQ( hits.last_addr, 0x4100cbu);
+    ASSERT_EQ( hits.last_size, 2u);
+
+    // block accesses are caught as well
+    func_mem.addWatchpoint( 0x600000, 0x2000, FuncMemory::WATCH_ACCESS, countWatchHit, &hits);
+    func_mem.fill( 0, 0x5ff000, 0x2000);
+    ASSERT_EQ( hits.writes, 4u);
+    uint8 block[ 16];
+    func_mem.readBlock( 0x5ffff8, block, sizeof( block));
+    ASSERT_EQ( hits.reads, 1u);
+    ASSERT_EQ( hits.last_addr, 0x600000u);
+    ASSERT_EQ( hits.last_size, 8u);
+
+    // the removed watchpoints cost nothing
+    func_mem.removeWatchpoint( 0x4100cc, 4);
+    func_mem.removeWatchpoint( 0x600000, 0x2000);
+    func_mem.write( 0x5, 0x4100cc);
+    func_mem.read( 0x600000);
+    ASSERT_EQ( hits.writes, 4u);
+    ASSERT_EQ( hits.reads, 1u);
+
+    FuncMemory flat_mem( valid_elf_file, 32, 10, 12, FuncMemory::FLAT_MAPPING);
+    ASSERT_EXIT( flat_mem.addWatchpoint( 0x4100cc, 4, FuncMemory::WATCH_WRITE, countWatchHit),
+                 ::testing::KilledBySignal( SIGABRT), ".*");
+}
+
+struct StressArgs
+{
+    FuncMemory* memory;
+    uint64 thread_num;
+    bool torn; // a torn value was read
+};
+
+static const uint64 STRESS_THREADS = 8;
+static const uint64 STRESS_PAGES = 64;
+static const uint64 STRESS_ROUNDS = 16;
+
+static const uint64 OWN_PAGES_ADDR = 0x1000000;    // disjoint pages of threads
+static const uint64 SHARED_PAGES_ADDR = 0x2000000; // a word per thread in each page
+static const uint64 COMMON_WORDS_ADDR = 0x3000000; // a word written by all threads
+
+static uint64 stressValue( uint64 thread_num, uint64 page, uint64 round)
+{
+    return ( thread_num << 48) | ( page << 16) | round;
+}
+
+static void* stressThread( void* arg)
+{
+    StressArgs* args = ( StressArgs*)arg;
+    FuncMemory* memory = args->memory;
+    uint64 thread_num = args->thread_num;
+
+    for ( uint64 round = 0; round < STRESS_ROUNDS; ++round)
+        for ( uint64 page = 0; page < STRESS_PAGES; ++page)
+        {
+            uint64 value = stressValue( thread_num, page, round);
+            uint64 own_addr = OWN_PAGES_ADDR + ( thread_num * STRESS_PAGES + page) * 0x1000;
+            uint64 shared_addr = SHARED_PAGES_ADDR + page * 0x1000 + thread_num * 8;
+            uint64 common_addr = COMMON_WORDS_ADDR + page * 0x1000;
+
+            memory->write<uint64, LITTLE_ENDIAN_ORDER, MultiThreaded>( value, own_addr);
+            memory->write<uint64, LITTLE_ENDIAN_ORDER, MultiThreaded>( value, shared_addr);
+
+            // all the bytes of the value must be written by the same thread
+            memory->write<uint64, LITTLE_ENDIAN_ORDER, MultiThreaded>(
+                0x0101010101010101ull * ( thread_num + 1), common_addr);
+            uint64 common = memory->read<uint64, LITTLE_ENDIAN_ORDER, MultiThreaded>( common_addr);
+            if ( common % 0x0101010101010101ull != 0)
+                args->torn = true;
+
+            // the page is shared with the snapshot
+            memory->write<uint8, LITTLE_ENDIAN_ORDER, MultiThreaded>( ( uint8)round,
+                                                                     0x4100c0 + 16 + thread_num);
+        }
+
+    return NULL;
+}
+
+TEST( Func_memory, Multi_Threaded_Stress_Test)
+{
+    FuncMemory::Backend backends[] = { FuncMemory::PAGE_TABLE, FuncMemory::FLAT_MAPPING };
+
+    for ( size_t i = 0; i < sizeof( backends) / sizeof( backends[ 0]); ++i)
+    {
+        FuncMemory func_mem( valid_elf_file, 32, 10, 12, backends[ i]);
+
+        // the threads copy the zero page and the pages of the snapshot concurrently
+        func_mem.fill( 0, SHARED_PAGES_ADDR, STRESS_PAGES * 0x1000);
+        FuncMemory::Snapshot* snapshot = NULL;
+        if ( backends[ i] == FuncMemory::PAGE_TABLE)
+            snapshot = func_mem.snapshot();
+
+        pthread_t threads[ STRESS_THREADS];
+        StressArgs args[ STRESS_THREADS];
+        for ( uint64 thread_num = 0; thread_num < STRESS_THREADS; ++thread_num)
+        {
+            args[ thread_num].memory = &func_mem;
+            args[ thread_num].thread_num = thread_num;
+            args[ thread_num].torn = false;
+            ASSERT_EQ( pthread_create( &threads[ thread_num], NULL,
+                                       stressThread, &args[ thread_num]), 0);
+        }
+
+        for ( uint64 thread_num = 0; thread_num < STRESS_THREADS; ++thread_num)
+            pthread_join( threads[ thread_num], NULL);
+
+        func_mem.flushTlb();
+
+        for ( uint64 thread_num = 0; thread_num < STRESS_THREADS; ++thread_num)
+        {
+            ASSERT_FALSE( args[ thread_num].torn);
+            ASSERT_EQ( func_mem.read( 0x4100c0 + 16 + thread_num, 1), STRESS_ROUNDS - 1);
+
+            for ( uint64 page = 0; page < STRESS_PAGES; ++page)
+            {
+                uint64 value = stressValue( thread_num, page, STRESS_ROUNDS - 1);
+                uint64 own_addr = OWN_PAGES_ADDR + ( thread_num * STRESS_PAGES + page) * 0x1000;
+                uint64 shared_addr = SHARED_PAGES_ADDR + page * 0x1000 + thread_num * 8;
+
+                ASSERT_EQ( func_mem.read<uint64>( own_addr), value);
+                ASSERT_EQ( func_mem.read<uint64>( shared_addr), value);
+            }
+        }
+
+        // the snapshot keeps the state before the threads
+        if ( snapshot != NULL)
+        {
+            func_mem.restore( *snapshot);
+            delete snapshot;
+            ASSERT_EQ( func_mem.read( 0x4100d0), 11u);
+            ASSERT_EQ( func_mem.read<uint64>( SHARED_PAGES_ADDR), 0u);
+        }
+    }
+}
+
 int main( int argc, char* argv[])
 {
     ::testing::InitGoogleTest( &argc, argv);